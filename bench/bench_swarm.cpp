@@ -0,0 +1,600 @@
+/*
+  Virtual participant swarm
+  Forks a manager built from the real services, then emulates thousands of participants from a single event loop
+  Every participant gets its own loopback address, a synthetic hostname and mac address, and speaks the real discovery and monitoring protocols
+  Once the table converges a few participants go silent without hanging up, the way a powered off machine would, to time dead host detection
+  Results are printed as a single JSON object on stdout, progress goes to stderr
+  usage: bench_swarm [participants] [silenced] [steady seconds]
+*/
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define NET_IMPLEMENTATION
+#include "../headers/Net/Net.hpp"
+#undef NET_IMPLEMENTATION
+
+#define FILE_DESCRIPTOR_IMPLEMENTATION
+#include "../headers/FileDescriptor.hpp"
+#undef FILE_DESCRIPTOR_IMPLEMENTATION
+
+#define EPOLL_IMPLEMENTATION
+#include "../headers/Epoll.hpp"
+#undef EPOLL_IMPLEMENTATION
+
+#define EVENT_FD_IMPLEMENTATION
+#include "../headers/EventFd.hpp"
+#undef EVENT_FD_IMPLEMENTATION
+
+#define ASYNC_IMPLEMENTATION
+#include "../headers/Async.hpp"
+#undef ASYNC_IMPLEMENTATION
+
+#define IO_ENGINE_IMPLEMENTATION
+#define IO_URING_IMPLEMENTATION
+#include "../headers/IoEngine.hpp"
+#undef IO_URING_IMPLEMENTATION
+#undef IO_ENGINE_IMPLEMENTATION
+
+#define SOCKET_IMPLEMENTATION
+#include "../headers/Net/Socket.hpp"
+#undef SOCKET_IMPLEMENTATION
+
+#define METRICS_IMPLEMENTATION
+#include "../headers/metrics.h"
+#undef METRICS_IMPLEMENTATION
+
+#define WIRE_PROTOCOL_IMPLEMENTATION
+#include "../headers/wire_protocol.h"
+#undef WIRE_PROTOCOL_IMPLEMENTATION
+
+#define DISCOVERY_SERVICE_IMPLEMENTATION
+#include "../headers/discovery_service.h"
+#undef DISCOVERY_SERVICE_IMPLEMENTATION
+
+#define MONITORING_SERVICE_IMPLEMENTATION
+#include "../headers/monitoring_service.h"
+#undef MONITORING_SERVICE_IMPLEMENTATION
+
+#define JOURNAL_IMPLEMENTATION
+#include "../headers/journal.h"
+#undef JOURNAL_IMPLEMENTATION
+
+#define MANAGEMENT_IMPLEMENTATION
+#include "../headers/management.hpp"
+#undef MANAGEMENT_IMPLEMENTATION
+
+// Kept away from the real service ports so a bench can run next to a manager
+#define BENCH_DISCOVERY_PORT (INITIAL_PORT + 60)
+#define BENCH_MONITORING_PORT (INITIAL_PORT + 61)
+#define BENCH_HELLO_RETRY_MS 250
+#define BENCH_CONVERGE_TIMEOUT_MS 60000
+#define BENCH_DETECT_TIMEOUT_MS (MONITORING_PROBE_MAX_MS + MONITORING_PROBE_MISSES * MONITORING_PROBE_TIMEOUT_MS + 10000)
+#define BENCH_MAX_EVENTS 256
+
+// Manager -> bench, written every time the published snapshot changes
+typedef struct manager_report_t
+{
+  int64_t at_us;
+  uint32_t joined; // awake and bound to a monitoring session
+  uint32_t asleep;
+  uint32_t total;
+} manager_report_t;
+
+// Manager -> bench, written once when the bench closes the control pipe
+typedef struct manager_usage_t
+{
+  int64_t user_us;
+  int64_t system_us;
+  long rss_kb;
+  long peak_rss_kb;
+  uint64_t probe_rtt_us[3]; // p50, p90, p99 from the manager probe histogram, bucket upper bounds
+  uint64_t lock_hold_ns[3]; // same percentiles of the table lock hold time
+  uint64_t io_syscalls;     // made by the monitoring I/O engines
+  uint64_t probes_sent;
+  int64_t io_uring_workers;
+} manager_usage_t;
+
+static long proc_status_kb(const char *field)
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  if (f == NULL)
+  {
+    return -1;
+  }
+  char line[256];
+  long value = -1;
+  size_t length = strlen(field);
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    if (strncmp(line, field, length) == 0 && line[length] == ':')
+    {
+      value = strtol(line + length + 1, NULL, 10);
+      break;
+    }
+  }
+  fclose(f);
+  return value;
+}
+
+// Table owner of the forked manager, mirrors server() in src/main.cpp without the UI
+static void run_manager(int control_fd, int report_fd)
+{
+  ParticipantTable participants;
+  DiscoveryService discovery_service;
+  MonitoringService monitoring_service;
+  discovery_service.port = BENCH_DISCOVERY_PORT;
+  monitoring_service.port = BENCH_MONITORING_PORT;
+  const char *io_engine = getenv("SLEEP_IO_ENGINE");
+  monitoring_service.io_engine = io_engine != NULL ? io_engine : "";
+  discovery_service.start_server();
+  monitoring_service.start_server(participants);
+
+  uint64_t reported = UINT64_MAX;
+  // Same wakeups as server() in src/main.cpp, with the control pipe in place of stdin
+  pollfd wakeups[] = {
+      {.fd = control_fd, .events = POLLIN, .revents = 0},
+      {.fd = discovery_service.ready.file_descriptor, .events = POLLIN, .revents = 0},
+      {.fd = participants.changed.file_descriptor, .events = POLLIN, .revents = 0}};
+  while (true)
+  {
+    int64_t wake_at = participants.timers.next_expiry_ms();
+    int timeout = wake_at == INT64_MAX ? -1 : (int)std::clamp<int64_t>(wake_at - monotonic_ms(), 0, INT_MAX);
+    if (poll(wakeups, sizeof(wakeups) / sizeof(wakeups[0]), timeout) < 0)
+    {
+      continue;
+    }
+    if (wakeups[0].revents & (POLLIN | POLLHUP))
+    {
+      break;
+    }
+    participants.apply_events();
+
+    discovery_service.ready.consume();
+    participants.lock();
+    participants.admit(discovery_service.endpoints);
+    Metrics::set(Metrics::DISCOVERY_QUEUE_DEPTH, discovery_service.endpoints.size_approx());
+    participants.expire(monotonic_ms());
+    participants.unlock();
+
+    participants.persist();
+    participants.publish_snapshot();
+    auto snapshot = participants.snapshot();
+    if (snapshot->version == reported)
+    {
+      continue;
+    }
+    reported = snapshot->version;
+    manager_report_t report = {.at_us = monotonic_us(), .joined = 0, .asleep = 0, .total = (uint32_t)snapshot->participants.size()};
+    for (const participant_t &participant : snapshot->participants)
+    {
+      report.joined += participant.status && participant.session != 0;
+      report.asleep += !participant.status;
+    }
+    if (write(report_fd, &report, sizeof(report)) < 0)
+    {
+      break;
+    }
+  }
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  manager_usage_t result = {
+      .user_us = (int64_t)usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec,
+      .system_us = (int64_t)usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec,
+      .rss_kb = proc_status_kb("VmRSS"),
+      .peak_rss_kb = proc_status_kb("VmHWM"),
+      .probe_rtt_us = {},
+      .lock_hold_ns = {},
+      .io_syscalls = Metrics::counter(Metrics::IO_SYSCALLS),
+      .probes_sent = Metrics::counter(Metrics::MONITORING_PROBES_SENT),
+      .io_uring_workers = Metrics::gauges[Metrics::IO_URING_WORKERS].load()};
+  const double fractions[3] = {0.5, 0.9, 0.99};
+  Metrics::histogram_snapshot_t probe_rtt = Metrics::histogram(Metrics::PROBE_RTT_US);
+  Metrics::histogram_snapshot_t lock_hold = Metrics::histogram(Metrics::TABLE_LOCK_HOLD_NS);
+  for (int i = 0; i < 3; i++)
+  {
+    result.probe_rtt_us[i] = probe_rtt.percentile(fractions[i]);
+    result.lock_hold_ns[i] = lock_hold.percentile(fractions[i]);
+  }
+  if (write(report_fd, &result, sizeof(result)) < 0)
+  {
+    perror("manager usage");
+  }
+  // The service threads block in the kernel, there is nothing worth unwinding
+  _exit(EXIT_SUCCESS);
+}
+
+enum ParticipantState
+{
+  PARTICIPANT_DISCOVERING,
+  PARTICIPANT_CONNECTING,
+  PARTICIPANT_CONNECTED,
+  PARTICIPANT_SILENT, // connected but never answers again
+};
+
+typedef struct virtual_participant_t
+{
+  in_addr_t address; // host order
+  MacAddress mac;
+  string hostname;
+  ParticipantState state;
+  int64_t next_hello_ms;
+  Socket udp_socket;
+  Socket tcp_socket;
+  string hello;
+  FrameDecoder decoder;
+} virtual_participant_t;
+
+struct Swarm
+{
+  std::vector<virtual_participant_t> participants;
+  std::vector<int64_t> probe_latencies_us;
+  Epoll epoll;
+  IpEndpoint discovery_endpoint;
+  IpEndpoint monitoring_endpoint;
+  unsigned char frame[WIRE_MAX_FRAME]; // outgoing monitoring frames are encoded here
+  size_t replies = 0;
+  size_t reconnects = 0;
+  bool recording = false;
+
+  static uint64_t tag(size_t index, bool tcp)
+  {
+    return (uint64_t)index << 1 | tcp;
+  }
+
+  int open(size_t count)
+  {
+    discovery_endpoint = IpEndpoint(InternetAddress::Loopback, BENCH_DISCOVERY_PORT);
+    monitoring_endpoint = IpEndpoint(InternetAddress::Loopback, BENCH_MONITORING_PORT);
+    participants = std::vector<virtual_participant_t>(count);
+    for (size_t i = 0; i < count; i++)
+    {
+      virtual_participant_t &participant = participants[i];
+      // 127.0.0.0/8 is routed to lo as a whole, every participant shows up with its own address
+      participant.address = INADDR_LOOPBACK + (uint32_t)((i / 250 + 1) << 8 | (i % 250 + 2));
+      // Locally administered addresses, unique per participant
+      const unsigned char mac[MAC_ADDR_MAX] = {0x02, 0x5c, (unsigned char)(i >> 24), (unsigned char)(i >> 16), (unsigned char)(i >> 8), (unsigned char)i};
+      participant.mac = MacAddress::from_bytes(mac);
+      char hostname[32];
+      snprintf(hostname, sizeof(hostname), "swarm-%06zu", i);
+      participant.hostname = hostname;
+      participant.hello = build_discovery_hello(participant.mac, participant.hostname);
+      participant.state = PARTICIPANT_DISCOVERING;
+      participant.next_hello_ms = 0;
+    }
+    return epoll.open();
+  }
+
+  // Opens the participant discovery socket on its own address
+  int discover(size_t index)
+  {
+    virtual_participant_t &participant = participants[index];
+    Socket &udp_socket = participant.udp_socket;
+    int result = udp_socket.open(SocketType(SocketType::Datagram | SocketType::NonBlocking), SocketProtocol::UDP);
+    result |= udp_socket.bind(Address(participant.address), 0);
+    result |= epoll.add(udp_socket.file_descriptor, EPOLLIN, tag(index, false));
+    return result;
+  }
+
+  void send_hellos(int64_t now)
+  {
+    for (virtual_participant_t &participant : participants)
+    {
+      if (participant.state != PARTICIPANT_DISCOVERING || participant.next_hello_ms > now)
+      {
+        continue;
+      }
+      participant.next_hello_ms = now + BENCH_HELLO_RETRY_MS;
+      participant.udp_socket.send(participant.hello.data(), participant.hello.size(), discovery_endpoint, MSG_DONTWAIT);
+    }
+  }
+
+  void connect(size_t index)
+  {
+    virtual_participant_t &participant = participants[index];
+    Socket &tcp_socket = participant.tcp_socket;
+    tcp_socket.close();
+    participant.decoder.reset();
+    int result = tcp_socket.open(SocketType(SocketType::Stream | SocketType::NonBlocking), SocketProtocol::TCP);
+    result |= tcp_socket.bind(Address(participant.address), 0);
+    if (result < 0 || (tcp_socket.connect(monitoring_endpoint) < 0 && errno != EINPROGRESS) ||
+        epoll.add(tcp_socket.file_descriptor, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, tag(index, true)) < 0)
+    {
+      perrorcode("swarm connect");
+      rediscover(index);
+      return;
+    }
+    participant.state = PARTICIPANT_CONNECTING;
+  }
+
+  void rediscover(size_t index)
+  {
+    virtual_participant_t &participant = participants[index];
+    participant.tcp_socket.close();
+    participant.state = PARTICIPANT_DISCOVERING;
+    participant.next_hello_ms = monotonic_ms() + BENCH_HELLO_RETRY_MS;
+    reconnects++;
+  }
+
+  // Stops answering without closing the connection, only the liveness timeout can notice
+  void silence(size_t index)
+  {
+    virtual_participant_t &participant = participants[index];
+    epoll.remove(participant.tcp_socket.file_descriptor);
+    participant.state = PARTICIPANT_SILENT;
+  }
+
+  void on_discovery(size_t index)
+  {
+    virtual_participant_t &participant = participants[index];
+    char reply[DISCOVERY_PACKET_MAX];
+    IpEndpoint from;
+    int read;
+    while ((read = participant.udp_socket.recv(reply, sizeof(reply), from, MSG_DONTWAIT)) >= 0)
+    {
+      if (participant.state == PARTICIPANT_DISCOVERING && string_view(reply, read) == server_msg)
+      {
+        connect(index);
+      }
+    }
+  }
+
+  void on_monitoring(size_t index, uint32_t events)
+  {
+    virtual_participant_t &participant = participants[index];
+    Socket &tcp_socket = participant.tcp_socket;
+    if (participant.state == PARTICIPANT_CONNECTING && (events & EPOLLOUT))
+    {
+      int error = 0;
+      socklen_t length = sizeof(error);
+      getsockopt(tcp_socket.file_descriptor, SOL_SOCKET, SO_ERROR, &error, &length);
+      size_t hello_length = frame_encode_hello(frame, sizeof(frame), participant.mac, participant.hostname);
+      if (error != 0 || tcp_socket.send(frame, hello_length, MSG_NOSIGNAL) < 0)
+      {
+        rediscover(index);
+        return;
+      }
+      participant.state = PARTICIPANT_CONNECTED;
+    }
+    if (participant.state != PARTICIPANT_CONNECTED || (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) == 0)
+    {
+      return;
+    }
+    while (true)
+    {
+      int read = participant.decoder.read_from(tcp_socket.file_descriptor);
+      if (read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+        return;
+      }
+      if (read <= 0)
+      {
+        rediscover(index);
+        return;
+      }
+      Frame frame;
+      while (participant.decoder.next(frame) == FRAME_READY)
+      {
+        uint64_t token;
+        if (frame.type != MESSAGE_PROBE || !frame_parse_probe(frame, token))
+        {
+          continue;
+        }
+        // Manager and swarm share CLOCK_MONOTONIC, so the token gives the delivery latency directly
+        if (recording)
+        {
+          probe_latencies_us.push_back(monotonic_us() - (int64_t)token);
+        }
+        size_t reply_length = frame_encode_probe(this->frame, sizeof(this->frame), MESSAGE_PROBE_REPLY, token);
+        if (tcp_socket.send(this->frame, reply_length, MSG_NOSIGNAL | MSG_DONTWAIT) > 0)
+        {
+          replies++;
+        }
+      }
+    }
+  }
+
+  void run(int timeout_ms)
+  {
+    epoll_event events[BENCH_MAX_EVENTS];
+    int ready = epoll.wait(events, BENCH_MAX_EVENTS, timeout_ms);
+    for (int i = 0; i < ready; i++)
+    {
+      size_t index = events[i].data.u64 >> 1;
+      if (events[i].data.u64 & 1)
+      {
+        on_monitoring(index, events[i].events);
+      }
+      else
+      {
+        on_discovery(index);
+      }
+    }
+  }
+};
+
+static bool read_report(int report_fd, manager_report_t &report)
+{
+  manager_report_t next;
+  bool updated = false;
+  while (read(report_fd, &next, sizeof(next)) == sizeof(next))
+  {
+    report = next;
+    updated = true;
+  }
+  return updated;
+}
+
+static int64_t percentile(const std::vector<int64_t> &sorted, double fraction)
+{
+  if (sorted.empty())
+  {
+    return -1;
+  }
+  size_t index = std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()));
+  return sorted[index];
+}
+
+int main(int argc, char **argv)
+{
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+  size_t silenced = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+  int steady_seconds = argc > 3 ? atoi(argv[3]) : 3;
+  silenced = std::min(silenced, count);
+  if (count == 0 || count > 250 * 250)
+  {
+    fprintf(stderr, "usage: bench_swarm [participants 1..62500] [silenced] [steady seconds]\n");
+    return EXIT_FAILURE;
+  }
+
+  // Two sockets per participant here and one in the manager
+  rlimit files;
+  getrlimit(RLIMIT_NOFILE, &files);
+  files.rlim_cur = files.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &files);
+  if (files.rlim_cur < 2 * count + 64)
+  {
+    fprintf(stderr, "bench_swarm: RLIMIT_NOFILE %lu is too low for %zu participants\n", (unsigned long)files.rlim_cur, count);
+    return EXIT_FAILURE;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  int control[2];
+  int reports[2];
+  if (pipe(control) < 0 || pipe2(reports, O_NONBLOCK) < 0)
+  {
+    perror("pipe");
+    return EXIT_FAILURE;
+  }
+  pid_t manager = fork();
+  if (manager < 0)
+  {
+    perror("fork");
+    return EXIT_FAILURE;
+  }
+  if (manager == 0)
+  {
+    close(control[1]);
+    close(reports[0]);
+    fcntl(reports[1], F_SETFL, 0);
+    run_manager(control[0], reports[1]);
+  }
+  close(control[0]);
+  close(reports[1]);
+
+  Swarm swarm;
+  if (swarm.open(count) < 0)
+  {
+    perror("swarm");
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < count; i++)
+  {
+    if (swarm.discover(i) < 0)
+    {
+      perrorcode("swarm discover");
+      return EXIT_FAILURE;
+    }
+  }
+  // Let the manager bind before the first hellos, lost ones are retried anyway
+  msleep(100);
+
+  manager_report_t report = {};
+  int64_t started = monotonic_us();
+  int64_t converged = -1;
+  fprintf(stderr, "bench_swarm: %zu participants joining\n", count);
+  while (monotonic_us() - started < BENCH_CONVERGE_TIMEOUT_MS * 1000LL)
+  {
+    swarm.send_hellos(monotonic_ms());
+    swarm.run(10);
+    if (read_report(reports[0], report) && report.joined >= count)
+    {
+      converged = report.at_us - started;
+      break;
+    }
+  }
+
+  fprintf(stderr, "bench_swarm: steady state for %d s\n", steady_seconds);
+  swarm.recording = true;
+  int64_t steady_until = monotonic_us() + steady_seconds * 1000000LL;
+  while (monotonic_us() < steady_until)
+  {
+    swarm.send_hellos(monotonic_ms());
+    swarm.run(10);
+    read_report(reports[0], report);
+  }
+  swarm.recording = false;
+
+  fprintf(stderr, "bench_swarm: silencing %zu participants\n", silenced);
+  uint32_t asleep_before = report.asleep;
+  int64_t silenced_at = monotonic_us();
+  int64_t detected = -1;
+  for (size_t i = 0; i < silenced; i++)
+  {
+    swarm.silence(count - 1 - i * (count / silenced));
+  }
+  while (silenced > 0 && monotonic_us() - silenced_at < BENCH_DETECT_TIMEOUT_MS * 1000LL)
+  {
+    swarm.send_hellos(monotonic_ms());
+    swarm.run(10);
+    if (read_report(reports[0], report) && report.asleep >= asleep_before + silenced)
+    {
+      detected = report.at_us - silenced_at;
+      break;
+    }
+  }
+
+  // Closing the control pipe stops the manager, its usage record is the last thing written before the pipe hits end of file
+  read_report(reports[0], report);
+  close(control[1]);
+  fcntl(reports[0], F_SETFL, 0);
+  string tail;
+  char buffer[256];
+  int read_bytes;
+  while ((read_bytes = read(reports[0], buffer, sizeof(buffer))) > 0)
+  {
+    tail.append(buffer, read_bytes);
+  }
+  manager_usage_t usage = {};
+  if (tail.size() >= sizeof(usage))
+  {
+    memcpy(&usage, tail.data() + tail.size() - sizeof(usage), sizeof(usage));
+  }
+  waitpid(manager, NULL, 0);
+
+  std::vector<int64_t> &latencies = swarm.probe_latencies_us;
+  std::sort(latencies.begin(), latencies.end());
+  double elapsed_s = (monotonic_us() - started) / 1e6;
+  printf("{\"participants\":%zu,\"converged\":%s,\"convergence_ms\":%.3f,"
+         "\"probe_samples\":%zu,\"probe_delivery_us\":{\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"max\":%ld},"
+         "\"probe_rtt_us\":{\"p50\":%lu,\"p90\":%lu,\"p99\":%lu},\"lock_hold_ns\":{\"p50\":%lu,\"p90\":%lu,\"p99\":%lu},"
+         "\"silenced\":%zu,\"dead_detection_ms\":%.3f,\"reconnects\":%zu,"
+         "\"manager\":{\"cpu_user_s\":%.3f,\"cpu_system_s\":%.3f,\"cpu_percent\":%.2f,\"rss_kb\":%ld,\"peak_rss_kb\":%ld,"
+         "\"io_engine\":\"%s\",\"io_syscalls\":%lu,\"probes_sent\":%lu},"
+         "\"final_table\":{\"total\":%u,\"joined\":%u,\"asleep\":%u}}\n",
+         count, converged >= 0 ? "true" : "false", converged >= 0 ? converged / 1000.0 : -1.0,
+         latencies.size(), (long)percentile(latencies, 0.5), (long)percentile(latencies, 0.9),
+         (long)percentile(latencies, 0.99), latencies.empty() ? -1L : (long)latencies.back(),
+         (unsigned long)usage.probe_rtt_us[0], (unsigned long)usage.probe_rtt_us[1], (unsigned long)usage.probe_rtt_us[2],
+         (unsigned long)usage.lock_hold_ns[0], (unsigned long)usage.lock_hold_ns[1], (unsigned long)usage.lock_hold_ns[2],
+         silenced, detected >= 0 ? detected / 1000.0 : -1.0, swarm.reconnects,
+         usage.user_us / 1e6, usage.system_us / 1e6, 100.0 * (usage.user_us + usage.system_us) / 1e6 / elapsed_s,
+         usage.rss_kb, usage.peak_rss_kb,
+         usage.io_uring_workers > 0 ? "io_uring" : "epoll", (unsigned long)usage.io_syscalls, (unsigned long)usage.probes_sent,
+         report.total, report.joined, report.asleep);
+  return converged >= 0 && (silenced == 0 || detected >= 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,271 @@
+/*
+  C++20 coroutines over epoll, one scheduler per thread
+  A receive is tried right away and only suspends when the socket says EAGAIN, the coroutine is then resumed by the scheduler once epoll reports the socket readable
+  Descriptors are registered edge triggered on first use and stay registered, so waiting again costs no syscall beyond the retry
+  Sleeping coroutines sit in a timer wheel, the scheduler blocks in epoll_wait until the next of them is due
+  Tasks start running when called and free themselves when they return, a suspended coroutine costs its frame and nothing else
+  Receives pass MSG_DONTWAIT, so the socket itself may stay blocking
+  A watched socket is closed through Async::close so no stale watch is left behind
+*/
+#ifndef ASYNC_H_
+#define ASYNC_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <coroutine>
+#include <exception>
+#include <unordered_map>
+#include <unordered_set>
+#include "macros.h"
+#include "Epoll.hpp"
+#include "DataStructures/TimerWheel.h"
+#include "Net/Socket.hpp"
+
+#define ASYNC_RESOLUTION_MS 10
+#define ASYNC_MAX_EVENTS 64
+
+namespace Async
+{
+  // Detached coroutine, runs until its first suspension when called
+  struct Task
+  {
+    struct promise_type
+    {
+      Task get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  // One batched receive, retried by the scheduler each time its descriptor becomes readable
+  struct IoAwaiter
+  {
+    int file_descriptor;
+    mmsghdr *messages;
+    unsigned int count;
+    int flags;
+    ssize_t result = -1;
+    int error = 0;
+    std::coroutine_handle<> handle = nullptr;
+
+    bool attempt();
+    bool await_ready() { return attempt(); }
+    bool await_suspend(std::coroutine_handle<> handle);
+    // The number of messages received, -1 with errno set when it failed
+    ssize_t await_resume();
+  };
+
+  struct SleepAwaiter
+  {
+    int64_t deadline_ms;
+
+    bool await_ready() { return monotonic_ms() >= deadline_ms; }
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() {}
+  };
+
+  struct Scheduler
+  {
+    Scheduler();
+    ~Scheduler();
+
+    // The scheduler of the calling thread, awaiting needs one
+    static Scheduler *current();
+
+    bool wait(IoAwaiter *awaiter);
+    void sleep_until(std::coroutine_handle<> handle, int64_t deadline_ms);
+    // Stops watching a descriptor before it is closed, a coroutine still waiting on it is destroyed
+    void forget(int file_descriptor);
+    // Resumes coroutines as their descriptors and timers fire, for as long as keep_running says so
+    // keep_running is checked at least every idle_ms
+    template <typename F>
+    void run_while(F &&keep_running, int idle_ms);
+
+  private:
+    Epoll epoll;
+    std::unordered_map<int, IoAwaiter *> watches; // the receive waiting on each descriptor, null once it completed
+    TimerWheel<std::coroutine_handle<>> timers;
+    std::unordered_set<uint32_t> sleepers; // armed timers, their coroutines are destroyed with the scheduler
+
+    int poll(int idle_ms);
+  };
+
+  IoAwaiter recv_batch(Socket &socket, mmsghdr *messages, unsigned int count, int flags = 0);
+  SleepAwaiter sleep(int64_t milliseconds);
+  // Forgets the socket on the scheduler of the calling thread, if there is one, then closes it
+  int close(Socket &socket);
+
+  template <typename F>
+  void Scheduler::run_while(F &&keep_running, int idle_ms)
+  {
+    while (keep_running())
+    {
+      if (poll(idle_ms) < 0)
+      {
+        perror("scheduler");
+        return;
+      }
+    }
+  }
+}
+
+#endif // ASYNC_H_
+#ifdef ASYNC_IMPLEMENTATION
+
+namespace Async
+{
+  static thread_local Scheduler *current_scheduler = nullptr;
+
+  // True when the receive is done, successfully or not, false when the descriptor is not ready
+  bool IoAwaiter::attempt()
+  {
+    result = ::recvmmsg(file_descriptor, messages, count, flags | MSG_DONTWAIT, NULL);
+    error = result < 0 ? errno : 0;
+    return !(result < 0 && (error == EAGAIN || error == EWOULDBLOCK || error == EINTR));
+  }
+
+  bool IoAwaiter::await_suspend(std::coroutine_handle<> handle)
+  {
+    this->handle = handle;
+    return Scheduler::current()->wait(this);
+  }
+
+  ssize_t IoAwaiter::await_resume()
+  {
+    errno = error;
+    return result;
+  }
+
+  void SleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+  {
+    Scheduler::current()->sleep_until(handle, deadline_ms);
+  }
+
+  IoAwaiter recv_batch(Socket &socket, mmsghdr *messages, unsigned int count, int flags)
+  {
+    return IoAwaiter{.file_descriptor = socket.file_descriptor, .messages = messages, .count = count, .flags = flags};
+  }
+
+  SleepAwaiter sleep(int64_t milliseconds)
+  {
+    return SleepAwaiter{.deadline_ms = monotonic_ms() + milliseconds};
+  }
+
+  int close(Socket &socket)
+  {
+    if (current_scheduler != nullptr)
+    {
+      current_scheduler->forget(socket.file_descriptor);
+    }
+    return socket.close();
+  }
+
+  Scheduler::Scheduler() : timers(ASYNC_RESOLUTION_MS, monotonic_ms())
+  {
+    if (epoll.open() < 0)
+    {
+      perror("scheduler epoll");
+    }
+    current_scheduler = this;
+  }
+
+  // Whatever is still suspended will never be resumed, destroying the frames runs their destructors
+  Scheduler::~Scheduler()
+  {
+    for (auto &[file_descriptor, awaiter] : watches)
+    {
+      if (awaiter != nullptr)
+      {
+        awaiter->handle.destroy();
+      }
+    }
+    for (uint32_t timer : sleepers)
+    {
+      timers[timer].destroy();
+    }
+    if (current_scheduler == this)
+    {
+      current_scheduler = nullptr;
+    }
+  }
+
+  Scheduler *Scheduler::current()
+  {
+    return current_scheduler;
+  }
+
+  // False when the descriptor cannot be watched, the operation then fails right away instead of waiting forever
+  bool Scheduler::wait(IoAwaiter *awaiter)
+  {
+    auto [it, created] = watches.try_emplace(awaiter->file_descriptor);
+    if (created && epoll.add(awaiter->file_descriptor, EPOLLIN | EPOLLRDHUP | EPOLLET, awaiter->file_descriptor) < 0)
+    {
+      awaiter->error = errno;
+      watches.erase(it);
+      return false;
+    }
+    it->second = awaiter;
+    return true;
+  }
+
+  void Scheduler::sleep_until(std::coroutine_handle<> handle, int64_t deadline_ms)
+  {
+    sleepers.insert(timers.schedule(handle, deadline_ms));
+  }
+
+  void Scheduler::forget(int file_descriptor)
+  {
+    auto it = watches.find(file_descriptor);
+    if (it == watches.end())
+    {
+      return;
+    }
+    epoll.remove(file_descriptor);
+    IoAwaiter *awaiter = it->second;
+    watches.erase(it);
+    if (awaiter != nullptr)
+    {
+      awaiter->handle.destroy();
+    }
+  }
+
+  int Scheduler::poll(int idle_ms)
+  {
+    int64_t now = monotonic_ms();
+    int64_t wake_at = std::min(timers.next_expiry_ms(), now + idle_ms);
+    epoll_event events[ASYNC_MAX_EVENTS];
+    int ready = epoll.wait(events, ASYNC_MAX_EVENTS, (int)std::max<int64_t>(wake_at - now, 0));
+    if (ready < 0)
+    {
+      return -1;
+    }
+    for (int i = 0; i < ready; i++)
+    {
+      auto it = watches.find((int)events[i].data.u64);
+      if (it == watches.end())
+      {
+        continue;
+      }
+      // The watch is cleared before resuming, the coroutine may wait again or forget the descriptor
+      IoAwaiter *awaiter = it->second;
+      if (awaiter != nullptr && awaiter->attempt())
+      {
+        it->second = nullptr;
+        awaiter->handle.resume();
+      }
+    }
+    timers.advance(monotonic_ms(), [this](uint32_t timer)
+                   {
+                     std::coroutine_handle<> handle = timers[timer];
+                     sleepers.erase(timer);
+                     timers.cancel(timer);
+                     handle.resume(); });
+    return ready;
+  }
+}
+
+#endif // ASYNC_IMPLEMENTATION
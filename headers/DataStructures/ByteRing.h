@@ -0,0 +1,162 @@
+/*
+  Fixed capacity byte ring buffer for per connection stream I/O
+  Reads and writes go straight between the socket and the ring with readv/sendmsg, covering the wrap around in one call
+  Nothing is ever moved or allocated, consumed bytes simply advance the read cursor
+*/
+#ifndef BYTE_RING_H_
+#define BYTE_RING_H_
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+template <size_t Capacity>
+struct ByteRing
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    unsigned char buffer[Capacity];
+    size_t head = 0; // total bytes consumed
+    size_t tail = 0; // total bytes produced
+
+    size_t size() const { return tail - head; }
+    size_t space() const { return Capacity - size(); }
+    bool empty() const { return head == tail; }
+    void clear() { head = tail = 0; }
+
+    // Splits the free space into at most two spans, returns how many were filled
+    int free_spans(iovec spans[2])
+    {
+        size_t free = space();
+        if (free == 0)
+        {
+            return 0;
+        }
+        size_t start = tail & (Capacity - 1);
+        size_t first = free < Capacity - start ? free : Capacity - start;
+        spans[0] = iovec{.iov_base = buffer + start, .iov_len = first};
+        if (first == free)
+        {
+            return 1;
+        }
+        spans[1] = iovec{.iov_base = buffer, .iov_len = free - first};
+        return 2;
+    }
+
+    // Splits the stored bytes into at most two spans, returns how many were filled
+    int used_spans(iovec spans[2])
+    {
+        size_t used = size();
+        if (used == 0)
+        {
+            return 0;
+        }
+        size_t start = head & (Capacity - 1);
+        size_t first = used < Capacity - start ? used : Capacity - start;
+        spans[0] = iovec{.iov_base = buffer + start, .iov_len = first};
+        if (first == used)
+        {
+            return 1;
+        }
+        spans[1] = iovec{.iov_base = buffer, .iov_len = used - first};
+        return 2;
+    }
+
+    // Fills the free space from the file descriptor, returns what readv returned
+    int read_from(int file_descriptor)
+    {
+        iovec spans[2];
+        int count = free_spans(spans);
+        if (count == 0)
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+        int result;
+        do
+        {
+            result = ::readv(file_descriptor, spans, count);
+        } while (result < 0 && errno == EINTR);
+        if (result > 0)
+        {
+            tail += result;
+        }
+        return result;
+    }
+
+    // Flushes as much as the socket takes, returns what sendmsg returned
+    // MSG_NOSIGNAL by default, so a peer that hung up is an EPIPE rather than a SIGPIPE
+    int write_to(int socket_descriptor, int flags = MSG_NOSIGNAL)
+    {
+        msghdr message = {};
+        iovec spans[2];
+        int count = used_spans(spans);
+        if (count == 0)
+        {
+            return 0;
+        }
+        message.msg_iov = spans;
+        message.msg_iovlen = count;
+        int result;
+        do
+        {
+            result = ::sendmsg(socket_descriptor, &message, flags);
+        } while (result < 0 && errno == EINTR);
+        if (result > 0)
+        {
+            head += result;
+        }
+        return result;
+    }
+
+    // Appends all bytes or none
+    bool push(const void *data, size_t length)
+    {
+        if (length > space())
+        {
+            return false;
+        }
+        size_t start = tail & (Capacity - 1);
+        size_t first = length < Capacity - start ? length : Capacity - start;
+        memcpy(buffer + start, data, first);
+        memcpy(buffer, (const unsigned char *)data + first, length - first);
+        tail += length;
+        return true;
+    }
+
+    // Copies bytes starting offset bytes past the read cursor without consuming them
+    bool peek(void *out, size_t length, size_t offset = 0) const
+    {
+        if (offset + length > size())
+        {
+            return false;
+        }
+        size_t start = (head + offset) & (Capacity - 1);
+        size_t first = length < Capacity - start ? length : Capacity - start;
+        memcpy(out, buffer + start, first);
+        memcpy((unsigned char *)out + first, buffer, length - first);
+        return true;
+    }
+
+    // Points at length bytes starting offset bytes past the read cursor
+    // The bytes are used in place unless they wrap around, then they are copied into scratch
+    const unsigned char *contiguous(size_t length, size_t offset, unsigned char *scratch) const
+    {
+        size_t start = (head + offset) & (Capacity - 1);
+        if (start + length <= Capacity)
+        {
+            return buffer + start;
+        }
+        peek(scratch, length, offset);
+        return scratch;
+    }
+
+    void consume(size_t length)
+    {
+        head += length < size() ? length : size();
+    }
+};
+
+#endif // BYTE_RING_H_
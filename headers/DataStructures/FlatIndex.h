@@ -0,0 +1,130 @@
+/*
+  Open addressing index from a hashed key to a dense 32 bit id, the keys themselves live with the caller
+  Slots hold the mixed hash next to the id, so probing compares integers and only asks the caller about real candidates
+  Linear probing with backward shift deletion, so there are no tombstones and lookups never slow down after removals
+  The table doubles once three quarters of the slots are taken, rehashing from the stored hashes alone
+*/
+#ifndef FLAT_INDEX_H_
+#define FLAT_INDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define FLAT_INDEX_NIL UINT32_MAX
+#define FLAT_INDEX_MIN_CAPACITY 16
+
+class FlatIndex
+{
+private:
+    struct index_slot
+    {
+        uint32_t hash;
+        uint32_t id; // FLAT_INDEX_NIL marks an empty slot
+    };
+
+    std::vector<index_slot> slots;
+    size_t mask;
+    size_t count;
+
+    static uint32_t mix(uint64_t hash)
+    {
+        return (uint32_t)((hash * 0x9e3779b97f4a7c15ull) >> 32);
+    }
+
+    // Slot holding id, the index is assumed to contain it
+    size_t slot_of(uint32_t hash, uint32_t id) const
+    {
+        size_t slot = hash & mask;
+        while (slots[slot].id != id)
+        {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    void place(index_slot entry)
+    {
+        size_t slot = entry.hash & mask;
+        while (slots[slot].id != FLAT_INDEX_NIL)
+        {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = entry;
+    }
+
+    void grow()
+    {
+        std::vector<index_slot> previous(slots.size() * 2, index_slot{0, FLAT_INDEX_NIL});
+        previous.swap(slots);
+        mask = slots.size() - 1;
+        for (const index_slot &entry : previous)
+        {
+            if (entry.id != FLAT_INDEX_NIL)
+            {
+                place(entry);
+            }
+        }
+    }
+
+public:
+    FlatIndex() : slots(FLAT_INDEX_MIN_CAPACITY, index_slot{0, FLAT_INDEX_NIL}), mask(FLAT_INDEX_MIN_CAPACITY - 1), count(0) {}
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // The id whose key hashes to hash and for which matches(id) holds, FLAT_INDEX_NIL when there is none
+    template <typename F>
+    uint32_t find(uint64_t hash, F &&matches) const
+    {
+        uint32_t mixed = mix(hash);
+        for (size_t slot = mixed & mask; slots[slot].id != FLAT_INDEX_NIL; slot = (slot + 1) & mask)
+        {
+            if (slots[slot].hash == mixed && matches(slots[slot].id))
+            {
+                return slots[slot].id;
+            }
+        }
+        return FLAT_INDEX_NIL;
+    }
+
+    // The key must not be in the index yet
+    void insert(uint64_t hash, uint32_t id)
+    {
+        if ((count + 1) * 4 > slots.size() * 3)
+        {
+            grow();
+        }
+        place(index_slot{mix(hash), id});
+        count++;
+    }
+
+    // Shifts the rest of the probe run back over the hole, so every entry stays reachable from its home slot
+    void erase(uint64_t hash, uint32_t id)
+    {
+        size_t hole = slot_of(mix(hash), id);
+        size_t next = (hole + 1) & mask;
+        while (slots[next].id != FLAT_INDEX_NIL)
+        {
+            size_t home = slots[next].hash & mask;
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                slots[hole] = slots[next];
+                hole = next;
+            }
+            next = (next + 1) & mask;
+        }
+        slots[hole].id = FLAT_INDEX_NIL;
+        count--;
+    }
+
+    // Points the entry of a key at the new id its owner moved it to
+    void relabel(uint64_t hash, uint32_t from, uint32_t to)
+    {
+        slots[slot_of(mix(hash), from)].id = to;
+    }
+};
+
+#endif // FLAT_INDEX_H_
@@ -0,0 +1,54 @@
+/*
+  Fixed capacity string stored inline, so structs holding one stay trivially copyable and never touch the heap
+  Assigning something longer than the capacity keeps the first Capacity characters, the text is always nul terminated
+*/
+#ifndef INLINE_STRING_H_
+#define INLINE_STRING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <algorithm>
+
+template <size_t Capacity>
+struct InlineString
+{
+    static_assert(Capacity <= UINT8_MAX, "the length is kept in a single byte");
+
+    uint8_t length = 0;
+    char text[Capacity + 1] = {};
+
+    InlineString() = default;
+    InlineString(std::string_view value)
+    {
+        assign(value);
+    }
+
+    void assign(std::string_view value)
+    {
+        length = (uint8_t)std::min(value.size(), Capacity);
+        memcpy(text, value.data(), length);
+        text[length] = '\0';
+    }
+
+    InlineString &operator=(std::string_view value)
+    {
+        assign(value);
+        return *this;
+    }
+
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const char *data() const { return text; }
+    const char *c_str() const { return text; }
+    std::string_view view() const { return std::string_view(text, length); }
+    std::string str() const { return std::string(text, length); }
+    operator std::string_view() const { return view(); }
+
+    bool operator==(std::string_view other) const { return view() == other; }
+    bool operator==(const InlineString &other) const { return view() == other.view(); }
+};
+
+#endif // INLINE_STRING_H_
@@ -0,0 +1,183 @@
+/*
+  Read-copy-update cell holding an immutable value that one writer replaces as a whole
+  Readers announce the epoch they started in on their own cache line and never write shared memory, so they scale with threads and never block the writer
+  Replaced values are retired and freed once every reader that could still see them has finished
+  A thread claims a reader slot in each cell it reads on first use and gives it back when it exits
+*/
+#ifndef RCU_H_
+#define RCU_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RCU_MAX_READERS 64
+#define RCU_CACHE_LINE 64
+
+namespace Concurrent
+{
+    template <typename T>
+    class RcuCell
+    {
+    private:
+        struct alignas(RCU_CACHE_LINE) reader_slot
+        {
+            std::atomic<uint64_t> epoch{0};
+            std::atomic<bool> claimed{false};
+            uint32_t depth = 0; // only touched by the thread owning the slot
+        };
+
+        struct reader_table
+        {
+            reader_slot slots[RCU_MAX_READERS];
+        };
+
+        // The slots a thread claimed, one per cell it read from
+        // Cells are only referenced weakly, so a cell destroyed before the thread exits is simply skipped
+        struct thread_claims
+        {
+            struct claim
+            {
+                const reader_table *table;
+                std::weak_ptr<reader_table> owner;
+                int index;
+            };
+            std::vector<claim> claims;
+
+            ~thread_claims()
+            {
+                for (claim &claimed : claims)
+                {
+                    if (std::shared_ptr<reader_table> table = claimed.owner.lock())
+                    {
+                        reader_slot &reader = table->slots[claimed.index];
+                        reader.depth = 0;
+                        reader.epoch.store(0, std::memory_order_release);
+                        reader.claimed.store(false, std::memory_order_release);
+                    }
+                }
+            }
+        };
+
+        std::atomic<T *> current;
+        std::atomic<uint64_t> epoch;
+        std::shared_ptr<reader_table> readers;
+        std::vector<std::pair<T *, uint64_t>> retired; // only touched by the writer
+
+        reader_slot &slot()
+        {
+            static thread_local thread_claims local;
+            for (const auto &claimed : local.claims)
+            {
+                // A new cell may live where a destroyed one did, its claims are stale
+                if (claimed.table == readers.get() && !claimed.owner.expired())
+                {
+                    return readers->slots[claimed.index];
+                }
+            }
+            local.claims.erase(std::remove_if(local.claims.begin(), local.claims.end(), [](const auto &claimed)
+                                              { return claimed.owner.expired(); }),
+                               local.claims.end());
+            for (int i = 0; i < RCU_MAX_READERS; i++)
+            {
+                bool expected = false;
+                if (readers->slots[i].claimed.compare_exchange_strong(expected, true))
+                {
+                    local.claims.push_back({readers.get(), readers, i});
+                    return readers->slots[i];
+                }
+            }
+            fprintf(stderr, "rcu: more than %d threads reading at once\n", RCU_MAX_READERS);
+            abort();
+        }
+
+    public:
+        // Keeps the value it was created with alive until destroyed
+        class ReadGuard
+        {
+        private:
+            reader_slot *slot;
+            const T *value;
+
+        public:
+            ReadGuard(reader_slot *slot, const T *value) : slot(slot), value(value) {}
+            ReadGuard(ReadGuard &&other) : slot(other.slot), value(other.value) { other.slot = nullptr; }
+            ReadGuard(const ReadGuard &) = delete;
+            ReadGuard &operator=(const ReadGuard &) = delete;
+            ~ReadGuard()
+            {
+                if (slot && --slot->depth == 0)
+                {
+                    slot->epoch.store(0, std::memory_order_release);
+                }
+            }
+            const T *operator->() const { return value; }
+            const T &operator*() const { return *value; }
+            const T *get() const { return value; }
+        };
+
+        RcuCell(T *initial = new T()) : current(initial), epoch(1), readers(std::make_shared<reader_table>()) {}
+        RcuCell(const RcuCell &) = delete;
+        RcuCell &operator=(const RcuCell &) = delete;
+        ~RcuCell()
+        {
+            for (auto &[value, _] : retired)
+            {
+                delete value;
+            }
+            delete current.load();
+        }
+
+        // Wait free, the returned guard pins the value it points to
+        ReadGuard read()
+        {
+            reader_slot &reader = slot();
+            if (reader.depth++ == 0)
+            {
+                reader.epoch.store(epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            }
+            return ReadGuard(&reader, current.load(std::memory_order_seq_cst));
+        }
+
+        // Single writer, replaces the value and frees whatever no reader can still see
+        void publish(T *next)
+        {
+            T *previous = current.exchange(next, std::memory_order_seq_cst);
+            retired.emplace_back(previous, epoch.fetch_add(1, std::memory_order_seq_cst));
+            reclaim();
+        }
+
+        void reclaim()
+        {
+            uint64_t oldest = UINT64_MAX;
+            for (auto &reader : readers->slots)
+            {
+                uint64_t reader_epoch = reader.epoch.load(std::memory_order_seq_cst);
+                if (reader_epoch != 0 && reader_epoch < oldest)
+                {
+                    oldest = reader_epoch;
+                }
+            }
+            size_t kept = 0;
+            for (auto &entry : retired)
+            {
+                if (entry.second < oldest)
+                {
+                    delete entry.first;
+                }
+                else
+                {
+                    retired[kept++] = entry;
+                }
+            }
+            retired.resize(kept);
+        }
+    };
+}
+
+#endif // RCU_H_
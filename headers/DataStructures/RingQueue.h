@@ -0,0 +1,193 @@
+/*
+  Bounded ring buffer queue based on Dmitry Vyukov's sequence numbered cells
+  Every cell carries a sequence number telling producers and consumers whose turn it is, so no node is ever allocated after construction
+  The producer and consumer sides are picked at compile time, a single producer or single consumer side skips the compare and swap
+  Producer and consumer cursors live on separate cache lines so both ends do not fight over the same line
+*/
+#ifndef RING_QUEUE_H_
+#define RING_QUEUE_H_
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+
+#define RING_QUEUE_CACHE_LINE 64
+#define RING_QUEUE_SPINS 64
+
+namespace Concurrent
+{
+    enum QueueMode
+    {
+        SPSC, // one producer thread, one consumer thread
+        MPSC, // many producer threads, one consumer thread
+        MPMC, // many producer threads, many consumer threads
+    };
+
+    template <typename T, size_t Capacity, QueueMode Mode = MPMC>
+    class RingQueue
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    private:
+        static constexpr bool single_producer = Mode == SPSC;
+        static constexpr bool single_consumer = Mode != MPMC;
+        static constexpr size_t mask = Capacity - 1;
+
+        struct cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<cell[]> cells;
+        alignas(RING_QUEUE_CACHE_LINE) std::atomic<size_t> enqueue_position;
+        alignas(RING_QUEUE_CACHE_LINE) std::atomic<size_t> dequeue_position;
+        char padding[RING_QUEUE_CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+        static void backoff(unsigned int &attempt)
+        {
+            if (attempt < RING_QUEUE_SPINS)
+            {
+                attempt++;
+                return;
+            }
+            if (attempt < 2 * RING_QUEUE_SPINS)
+            {
+                attempt++;
+                sched_yield();
+                return;
+            }
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = 100000};
+            nanosleep(&ts, NULL);
+        }
+
+    public:
+        RingQueue() : cells(new cell[Capacity]), enqueue_position(0), dequeue_position(0)
+        {
+            for (size_t i = 0; i < Capacity; i++)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+        RingQueue(const RingQueue &) = delete;
+        RingQueue &operator=(const RingQueue &) = delete;
+
+        bool try_enqueue(const T &value)
+        {
+            size_t position = enqueue_position.load(std::memory_order_relaxed);
+            cell *target;
+            while (true)
+            {
+                target = &cells[position & mask];
+                size_t sequence = target->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+                if (difference < 0)
+                {
+                    return false;
+                }
+                if constexpr (single_producer)
+                {
+                    enqueue_position.store(position + 1, std::memory_order_relaxed);
+                    break;
+                }
+                else
+                {
+                    if (difference == 0 && enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                    if (difference > 0)
+                    {
+                        position = enqueue_position.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+            target->value = value;
+            target->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool try_dequeue(T &result)
+        {
+            size_t position = dequeue_position.load(std::memory_order_relaxed);
+            cell *target;
+            while (true)
+            {
+                target = &cells[position & mask];
+                size_t sequence = target->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+                if (difference < 0)
+                {
+                    return false;
+                }
+                if constexpr (single_consumer)
+                {
+                    dequeue_position.store(position + 1, std::memory_order_relaxed);
+                    break;
+                }
+                else
+                {
+                    if (difference == 0 && dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                    if (difference > 0)
+                    {
+                        position = dequeue_position.load(std::memory_order_relaxed);
+                    }
+                }
+            }
+            result = target->value;
+            target->sequence.store(position + Capacity, std::memory_order_release);
+            return true;
+        }
+
+        // Waits for a free cell, spinning first and then yielding the cpu
+        void enqueue(const T &value)
+        {
+            unsigned int attempt = 0;
+            while (!try_enqueue(value))
+            {
+                backoff(attempt);
+            }
+        }
+
+        // Waits for a value, spinning first and then yielding the cpu
+        void dequeue(T &result)
+        {
+            unsigned int attempt = 0;
+            while (!try_dequeue(result))
+            {
+                backoff(attempt);
+            }
+        }
+
+        // Moves up to max_count values into results, returns how many were moved
+        size_t drain(T *results, size_t max_count)
+        {
+            size_t count = 0;
+            while (count < max_count && try_dequeue(results[count]))
+            {
+                count++;
+            }
+            return count;
+        }
+
+        size_t size_approx() const
+        {
+            size_t enqueued = enqueue_position.load(std::memory_order_relaxed);
+            size_t dequeued = dequeue_position.load(std::memory_order_relaxed);
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+
+        static constexpr size_t capacity()
+        {
+            return Capacity;
+        }
+    };
+}
+
+#endif // RING_QUEUE_H_
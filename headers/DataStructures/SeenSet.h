@@ -0,0 +1,140 @@
+/*
+  Open addressing set of recently seen 64 bit keys, each remembered for a limited time along with a small value
+  Lookups and inserts probe linearly from the hashed slot, expired entries keep their slot until the next rebuild
+  The table is rebuilt from the live entries once three quarters of the slots are taken, growing only when the live entries need it
+*/
+#ifndef SEEN_SET_H_
+#define SEEN_SET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+template <typename V>
+class SeenSet
+{
+private:
+    struct seen_entry
+    {
+        uint64_t key; // stored plus one, zero marks a slot that was never used
+        int64_t expires_ms;
+        V value;
+    };
+
+    std::vector<seen_entry> entries;
+    size_t mask;
+    size_t used; // slots taken, expired entries included
+
+    size_t slot_of(uint64_t key) const
+    {
+        return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+    }
+
+    // Keeps the live entries only, doubling the capacity while they would fill more than half of it
+    void rebuild(int64_t now_ms)
+    {
+        std::vector<seen_entry> previous;
+        previous.swap(entries);
+        size_t live = 0;
+        for (const seen_entry &entry : previous)
+        {
+            live += entry.key != 0 && entry.expires_ms > now_ms;
+        }
+        size_t capacity = previous.size();
+        while (live * 2 > capacity)
+        {
+            capacity *= 2;
+        }
+        entries.assign(capacity, seen_entry{});
+        mask = capacity - 1;
+        used = 0;
+        for (const seen_entry &entry : previous)
+        {
+            if (entry.key == 0 || entry.expires_ms <= now_ms)
+            {
+                continue;
+            }
+            size_t slot = slot_of(entry.key - 1);
+            while (entries[slot].key != 0)
+            {
+                slot = (slot + 1) & mask;
+            }
+            entries[slot] = entry;
+            used++;
+        }
+    }
+
+public:
+    // Capacity is rounded up to a power of two
+    explicit SeenSet(size_t capacity) : used(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        entries.assign(size, seen_entry{});
+        mask = size - 1;
+    }
+
+    // The value remembered for key, nullptr when the key was never seen or its time ran out
+    V *find(uint64_t key, int64_t now_ms)
+    {
+        for (size_t slot = slot_of(key); entries[slot].key != 0; slot = (slot + 1) & mask)
+        {
+            if (entries[slot].key == key + 1)
+            {
+                return entries[slot].expires_ms > now_ms ? &entries[slot].value : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // Remembers key for ttl_ms more, the returned value is only valid until the next insert
+    V &insert(uint64_t key, const V &value, int64_t now_ms, int64_t ttl_ms)
+    {
+        if ((used + 1) * 4 > entries.size() * 3)
+        {
+            rebuild(now_ms);
+        }
+        size_t found = SIZE_MAX;
+        size_t expired = SIZE_MAX;
+        size_t slot = slot_of(key);
+        for (; entries[slot].key != 0; slot = (slot + 1) & mask)
+        {
+            if (entries[slot].key == key + 1)
+            {
+                found = slot;
+                break;
+            }
+            if (expired == SIZE_MAX && entries[slot].expires_ms <= now_ms)
+            {
+                expired = slot;
+            }
+        }
+        // A new key takes the first expired slot of its chain before it takes an empty one
+        if (found == SIZE_MAX)
+        {
+            found = expired;
+        }
+        if (found == SIZE_MAX)
+        {
+            found = slot;
+            used++;
+        }
+        entries[found] = seen_entry{.key = key + 1, .expires_ms = now_ms + ttl_ms, .value = value};
+        return entries[found].value;
+    }
+
+    size_t size() const
+    {
+        return used;
+    }
+
+    size_t capacity() const
+    {
+        return entries.size();
+    }
+};
+
+#endif // SEEN_SET_H_
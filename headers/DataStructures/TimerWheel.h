@@ -0,0 +1,223 @@
+/*
+  Hierarchical timer wheel
+  Timers live in intrusive doubly linked lists inside a flat node pool and are addressed by a stable handle
+  Scheduling, re-arming and cancelling are O(1), advancing only touches the slots that became due
+  Timers further away than the first level are parked in coarser levels and cascade down as time reaches them
+*/
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_NIL UINT32_MAX
+
+template <typename T>
+class TimerWheel
+{
+private:
+    struct timer_node
+    {
+        T value;
+        int64_t deadline; // in ticks
+        uint32_t prev;
+        uint32_t next;
+        uint32_t slot; // TIMER_NIL when not scheduled
+    };
+
+    std::vector<timer_node> nodes;
+    std::vector<uint32_t> free_nodes;
+    uint32_t slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+    int64_t resolution_ms;
+    int64_t current_tick;
+    size_t scheduled;
+
+    void link(uint32_t handle, int64_t min_tick)
+    {
+        timer_node &node = nodes[handle];
+        int64_t tick = std::max(node.deadline, min_tick);
+        int64_t delta = tick - current_tick;
+        int level = 0;
+        while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1LL << (TIMER_WHEEL_BITS * (level + 1))))
+        {
+            level++;
+        }
+        int64_t range = 1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+        if (delta >= range)
+        {
+            tick = current_tick + range - 1;
+        }
+        uint32_t slot = level * TIMER_WHEEL_SLOTS + ((tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        node.slot = slot;
+        node.prev = TIMER_NIL;
+        node.next = slots[slot];
+        if (node.next != TIMER_NIL)
+        {
+            nodes[node.next].prev = handle;
+        }
+        slots[slot] = handle;
+        scheduled++;
+    }
+
+    void unlink(uint32_t handle)
+    {
+        timer_node &node = nodes[handle];
+        if (node.slot == TIMER_NIL)
+        {
+            return;
+        }
+        if (node.prev != TIMER_NIL)
+        {
+            nodes[node.prev].next = node.next;
+        }
+        else
+        {
+            slots[node.slot] = node.next;
+        }
+        if (node.next != TIMER_NIL)
+        {
+            nodes[node.next].prev = node.prev;
+        }
+        node.slot = TIMER_NIL;
+        scheduled--;
+    }
+
+    void cascade(int level)
+    {
+        uint32_t slot = level * TIMER_WHEEL_SLOTS + ((current_tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        while (slots[slot] != TIMER_NIL)
+        {
+            uint32_t handle = slots[slot];
+            unlink(handle);
+            link(handle, current_tick);
+        }
+    }
+
+public:
+    TimerWheel(int64_t resolution_ms, int64_t now_ms) : resolution_ms(resolution_ms), current_tick(now_ms / resolution_ms), scheduled(0)
+    {
+        std::fill(std::begin(slots), std::end(slots), TIMER_NIL);
+    }
+
+    // Returns a handle that stays valid until cancelled
+    uint32_t schedule(const T &value, int64_t deadline_ms)
+    {
+        uint32_t handle;
+        if (!free_nodes.empty())
+        {
+            handle = free_nodes.back();
+            free_nodes.pop_back();
+        }
+        else
+        {
+            handle = nodes.size();
+            nodes.push_back(timer_node{});
+        }
+        nodes[handle].value = value;
+        nodes[handle].slot = TIMER_NIL;
+        reschedule(handle, deadline_ms);
+        return handle;
+    }
+
+    // Moves a timer to a new deadline, also re-arms a timer that already fired
+    void reschedule(uint32_t handle, int64_t deadline_ms)
+    {
+        unlink(handle);
+        nodes[handle].deadline = deadline_ms / resolution_ms;
+        link(handle, current_tick + 1);
+    }
+
+    // Stops the timer without releasing its handle
+    void disarm(uint32_t handle)
+    {
+        unlink(handle);
+    }
+
+    // Stops the timer and releases its handle
+    void cancel(uint32_t handle)
+    {
+        unlink(handle);
+        free_nodes.push_back(handle);
+    }
+
+    bool armed(uint32_t handle) const
+    {
+        return nodes[handle].slot != TIMER_NIL;
+    }
+
+    size_t size() const
+    {
+        return scheduled;
+    }
+
+    T &operator[](uint32_t handle)
+    {
+        return nodes[handle].value;
+    }
+
+    // Earliest time advance() may have something to do, INT64_MAX when nothing is scheduled
+    // Exact for timers in the first level, for coarser levels it is when their slot cascades down
+    int64_t next_expiry_ms() const
+    {
+        if (scheduled == 0)
+        {
+            return INT64_MAX;
+        }
+        int64_t earliest = current_tick + (1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS));
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            int shift = TIMER_WHEEL_BITS * level;
+            int64_t level_tick = current_tick >> shift;
+            for (int64_t i = 1; i <= TIMER_WHEEL_SLOTS; i++)
+            {
+                if (slots[level * TIMER_WHEEL_SLOTS + ((level_tick + i) & TIMER_WHEEL_MASK)] != TIMER_NIL)
+                {
+                    earliest = std::min(earliest, (level_tick + i) << shift);
+                    break;
+                }
+            }
+        }
+        return earliest * resolution_ms;
+    }
+
+    // Fires every timer due by now_ms, the callback receives the handle and may re-arm or cancel any timer
+    template <typename F>
+    size_t advance(int64_t now_ms, F &&on_expire)
+    {
+        int64_t target_tick = now_ms / resolution_ms;
+        size_t fired = 0;
+        while (current_tick < target_tick)
+        {
+            if (scheduled == 0)
+            {
+                current_tick = target_tick;
+                break;
+            }
+            current_tick++;
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+            {
+                if (current_tick & ((1LL << (TIMER_WHEEL_BITS * level)) - 1))
+                {
+                    break;
+                }
+                cascade(level);
+            }
+            uint32_t slot = current_tick & TIMER_WHEEL_MASK;
+            while (slots[slot] != TIMER_NIL)
+            {
+                uint32_t handle = slots[slot];
+                unlink(handle);
+                fired++;
+                on_expire(handle);
+            }
+        }
+        return fired;
+    }
+};
+
+#endif // TIMER_WHEEL_H_
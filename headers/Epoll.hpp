@@ -0,0 +1,62 @@
+/*
+  Adapts the linux epoll api to a more c++ like api
+  File descriptors are registered once and readiness is reported in batches, so the caller never rescans idle descriptors
+*/
+#ifndef EPOLL_H_
+#define EPOLL_H_
+
+#include <sys/epoll.h>
+#include "FileDescriptor.hpp"
+
+struct Epoll : FileDescriptor
+{
+  Epoll() : FileDescriptor() {}
+
+  int open();
+  int add(int file_descriptor, uint32_t events, uint64_t data);
+  int modify(int file_descriptor, uint32_t events, uint64_t data);
+  int remove(int file_descriptor);
+  int wait(epoll_event *events, int max_events, int timeout);
+};
+
+#endif // EPOLL_H_
+#ifdef EPOLL_IMPLEMENTATION
+
+int Epoll::open()
+{
+  file_descriptor = ::epoll_create1(EPOLL_CLOEXEC);
+  return file_descriptor;
+}
+
+int Epoll::add(int fd, uint32_t events, uint64_t data)
+{
+  epoll_event event = {};
+  event.events = events;
+  event.data.u64 = data;
+  return ::epoll_ctl(file_descriptor, EPOLL_CTL_ADD, fd, &event);
+}
+
+int Epoll::modify(int fd, uint32_t events, uint64_t data)
+{
+  epoll_event event = {};
+  event.events = events;
+  event.data.u64 = data;
+  return ::epoll_ctl(file_descriptor, EPOLL_CTL_MOD, fd, &event);
+}
+
+int Epoll::remove(int fd)
+{
+  return ::epoll_ctl(file_descriptor, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int Epoll::wait(epoll_event *events, int max_events, int timeout)
+{
+  int result;
+  do
+  {
+    result = ::epoll_wait(file_descriptor, events, max_events, timeout);
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
+
+#endif // EPOLL_IMPLEMENTATION
@@ -0,0 +1,60 @@
+/*
+  Adapts the linux eventfd api to a wakeup signal that can sit in a poll set next to sockets
+  Producers only write to the descriptor when the consumer has not been told yet, so a burst of events costs a single syscall
+*/
+#ifndef EVENT_FD_H_
+#define EVENT_FD_H_
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <atomic>
+#include "FileDescriptor.hpp"
+
+struct EventFd : FileDescriptor
+{
+  std::atomic<bool> pending;
+
+  EventFd() : FileDescriptor(), pending(false) {}
+
+  int open();
+  void notify();
+  void consume();
+};
+
+#endif // EVENT_FD_H_
+#ifdef EVENT_FD_IMPLEMENTATION
+
+int EventFd::open()
+{
+  file_descriptor = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  return file_descriptor;
+}
+
+// Safe to call from any thread, wakes the consumer unless it was already woken and has not consumed yet
+void EventFd::notify()
+{
+  if (file_descriptor == -1 || pending.exchange(true))
+  {
+    return;
+  }
+  uint64_t one = 1;
+  if (::write(file_descriptor, &one, sizeof(one)) < 0 && errno != EAGAIN)
+  {
+    perror("eventfd notify");
+  }
+}
+
+// Called by the consumer before it looks at the queue, anything published after this wakes it again
+void EventFd::consume()
+{
+  pending.store(false);
+  uint64_t count;
+  if (::read(file_descriptor, &count, sizeof(count)) < 0 && errno != EAGAIN)
+  {
+    perror("eventfd consume");
+  }
+}
+
+#endif // EVENT_FD_IMPLEMENTATION
@@ -55,22 +55,20 @@ pollfd FileDescriptor::poll(int events, int timeout)
   return fd;
 }
 
+// The pollfd array is kept per thread and only grows, null entries are skipped by the kernel
 std::vector<pollfd> FileDescriptor::poll(std::vector<FileDescriptor *> &file_descriptors, int poll_events, int timeout)
 {
+  static thread_local std::vector<pollfd> fds;
   nfds_t size = file_descriptors.size();
-  pollfd fds[size];
+  fds.resize(size);
   for (nfds_t i = 0; i < size; i++)
   {
     FileDescriptor *fd = file_descriptors[i];
-    if (fd)
-    {
-      fds[i].fd = fd->file_descriptor;
-      fds[i].events = poll_events;
-    }
+    fds[i] = pollfd{.fd = fd ? fd->file_descriptor : -1, .events = (short)poll_events, .revents = 0};
   }
 
-  int num_events = ::poll((pollfd *)fds, size, timeout);
-  if (num_events == 0)
+  int num_events = ::poll(fds.data(), size, timeout);
+  if (num_events <= 0)
   {
     return std::vector<pollfd>{};
   }
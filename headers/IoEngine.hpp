@@ -0,0 +1,345 @@
+/*
+  Pluggable completion style I/O engine for the socket heavy loops
+  The caller registers descriptors once under a 56 bit tag of its own, sends through the tag and collects everything that happened in one wait
+  Accepted connections, received bytes, datagrams and hangups come back as events whose data stays valid until the next wait
+  The io_uring engine (see IoUring.hpp) keeps accepts and receives armed in the kernel and submits a whole tick of sends in the same syscall as the wait
+  The epoll engine is the plain syscall fallback, for kernels or sandboxes without io_uring
+*/
+#ifndef IO_ENGINE_H_
+#define IO_ENGINE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Epoll.hpp"
+#include "DataStructures/ByteRing.h"
+#include "metrics.h"
+
+#define IO_TAG_MAX ((1ULL << 56) - 1)
+#define IO_BUFFER_SIZE 2048      // the most one receive or datagram event carries
+#define IO_PENDING_MAX 4096      // bytes a stream may have queued behind a slow peer before sends are refused
+#define IO_EPOLL_MAX_EVENTS 256
+
+enum IoEventKind
+{
+  IO_ACCEPTED, // a listener handed over a new connection
+  IO_RECEIVED, // bytes arrived on a stream
+  IO_DATAGRAM, // a datagram arrived on a datagram socket
+  IO_CLOSED,   // a stream hung up or failed, nothing more will come from it
+};
+
+typedef struct io_event_t
+{
+  IoEventKind kind;
+  uint64_t tag;
+  int file_descriptor; // the new connection of IO_ACCEPTED, owned by the caller
+  int error;           // why IO_CLOSED happened, 0 for an orderly hangup
+  int flags;           // MSG_TRUNC when a datagram did not fit
+  const unsigned char *data;
+  size_t length;
+  sockaddr_in address; // peer of IO_ACCEPTED, sender of IO_DATAGRAM
+} io_event_t;
+
+struct IoEngine
+{
+  virtual ~IoEngine() {}
+
+  virtual const char *name() const = 0;
+  // Keeps accepting on a listening socket until the tag is removed
+  virtual int listen(int file_descriptor, uint64_t tag) = 0;
+  // Keeps receiving on a connected stream until it hangs up or the tag is removed
+  virtual int receive(int file_descriptor, uint64_t tag) = 0;
+  // Keeps receiving datagrams until the tag is removed
+  virtual int receive_datagrams(int file_descriptor, uint64_t tag) = 0;
+  // Queues bytes on a stream registered with receive(), a failure is reported later as IO_CLOSED
+  virtual int send(uint64_t tag, const void *data, size_t length) = 0;
+  // Stops everything on the tag, the caller closes the descriptor afterwards
+  virtual void remove(uint64_t tag) = 0;
+  // Submits what was queued and waits up to timeout_ms for events, -1 waits forever
+  virtual int wait(io_event_t *events, int max_events, int timeout_ms) = 0;
+
+  // The io_uring engine unless preferred is "epoll" or io_uring is not usable here, the epoll engine otherwise
+  static std::unique_ptr<IoEngine> create(const std::string &preferred);
+};
+
+enum IoSourceKind
+{
+  IO_SOURCE_LISTENER,
+  IO_SOURCE_STREAM,
+  IO_SOURCE_DATAGRAMS,
+};
+
+typedef struct epoll_source_t
+{
+  int file_descriptor;
+  IoSourceKind kind;
+  ByteRing<IO_PENDING_MAX> pending; // bytes the socket did not take yet, flushed on EPOLLOUT
+} epoll_source_t;
+
+// Readiness based engine, every accept, receive and send is its own syscall
+struct EpollEngine : IoEngine
+{
+  const char *name() const override;
+  int listen(int file_descriptor, uint64_t tag) override;
+  int receive(int file_descriptor, uint64_t tag) override;
+  int receive_datagrams(int file_descriptor, uint64_t tag) override;
+  int send(uint64_t tag, const void *data, size_t length) override;
+  void remove(uint64_t tag) override;
+  int wait(io_event_t *events, int max_events, int timeout_ms) override;
+
+  int open();
+
+private:
+  Epoll epoll;
+  std::unordered_map<uint64_t, epoll_source_t> sources;
+  std::vector<io_event_t> failed; // send failures, reported by the next wait
+  std::vector<unsigned char> buffers;
+  std::vector<iovec> iovecs;
+  std::vector<mmsghdr> messages;
+
+  int add(int file_descriptor, uint64_t tag, IoSourceKind kind);
+  bool flush(epoll_source_t &source);
+};
+
+#include "IoUring.hpp"
+
+#endif // IO_ENGINE_H_
+#ifdef IO_ENGINE_IMPLEMENTATION
+
+std::unique_ptr<IoEngine> IoEngine::create(const std::string &preferred)
+{
+  if (preferred != "epoll")
+  {
+    std::unique_ptr<IoEngine> uring = UringEngine::create();
+    if (uring)
+    {
+      return uring;
+    }
+  }
+  std::unique_ptr<EpollEngine> engine = std::make_unique<EpollEngine>();
+  if (engine->open() < 0)
+  {
+    return nullptr;
+  }
+  return engine;
+}
+
+const char *EpollEngine::name() const
+{
+  return "epoll";
+}
+
+int EpollEngine::open()
+{
+  return epoll.open();
+}
+
+// Level triggered, so whatever one wait leaves behind is reported again by the next
+int EpollEngine::add(int file_descriptor, uint64_t tag, IoSourceKind kind)
+{
+  if (epoll.add(file_descriptor, EPOLLIN, tag) < 0)
+  {
+    return -1;
+  }
+  epoll_source_t &source = sources[tag];
+  source.file_descriptor = file_descriptor;
+  source.kind = kind;
+  source.pending.clear();
+  return 0;
+}
+
+int EpollEngine::listen(int file_descriptor, uint64_t tag)
+{
+  return add(file_descriptor, tag, IO_SOURCE_LISTENER);
+}
+
+int EpollEngine::receive(int file_descriptor, uint64_t tag)
+{
+  return add(file_descriptor, tag, IO_SOURCE_STREAM);
+}
+
+int EpollEngine::receive_datagrams(int file_descriptor, uint64_t tag)
+{
+  return add(file_descriptor, tag, IO_SOURCE_DATAGRAMS);
+}
+
+// Writes what is queued, false when the peer is gone
+bool EpollEngine::flush(epoll_source_t &source)
+{
+  while (!source.pending.empty())
+  {
+    Metrics::add(Metrics::IO_SYSCALLS);
+    if (source.pending.write_to(source.file_descriptor, MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+    {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+  }
+  return true;
+}
+
+int EpollEngine::send(uint64_t tag, const void *data, size_t length)
+{
+  auto it = sources.find(tag);
+  if (it == sources.end() || it->second.kind != IO_SOURCE_STREAM)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  epoll_source_t &source = it->second;
+  bool idle = source.pending.empty();
+  if (!source.pending.push(data, length))
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+  if (!flush(source))
+  {
+    failed.push_back(io_event_t{.kind = IO_CLOSED, .tag = tag, .file_descriptor = -1, .error = errno, .flags = 0, .data = NULL, .length = 0, .address = {}});
+    return 0;
+  }
+  // Whatever did not fit goes out once the socket drains
+  if (idle && !source.pending.empty())
+  {
+    epoll.modify(source.file_descriptor, EPOLLIN | EPOLLOUT, tag);
+  }
+  return 0;
+}
+
+void EpollEngine::remove(uint64_t tag)
+{
+  auto it = sources.find(tag);
+  if (it == sources.end())
+  {
+    return;
+  }
+  epoll.remove(it->second.file_descriptor);
+  sources.erase(it);
+}
+
+int EpollEngine::wait(io_event_t *events, int max_events, int timeout_ms)
+{
+  int count = 0;
+  while (!failed.empty() && count < max_events)
+  {
+    events[count++] = failed.back();
+    failed.pop_back();
+  }
+  if (buffers.size() < (size_t)max_events * IO_BUFFER_SIZE)
+  {
+    buffers.resize((size_t)max_events * IO_BUFFER_SIZE);
+    iovecs.resize(max_events);
+    messages.resize(max_events);
+  }
+
+  epoll_event ready[IO_EPOLL_MAX_EVENTS];
+  Metrics::add(Metrics::IO_SYSCALLS);
+  int result = epoll.wait(ready, std::min(max_events, IO_EPOLL_MAX_EVENTS), count > 0 ? 0 : timeout_ms);
+  if (result < 0)
+  {
+    return count > 0 ? count : -1;
+  }
+
+  for (int i = 0; i < result && count < max_events; i++)
+  {
+    uint64_t tag = ready[i].data.u64;
+    auto it = sources.find(tag);
+    if (it == sources.end())
+    {
+      continue;
+    }
+    epoll_source_t &source = it->second;
+    if (source.kind == IO_SOURCE_LISTENER)
+    {
+      while (count < max_events)
+      {
+        io_event_t &event = events[count];
+        socklen_t address_length = sizeof(event.address);
+        Metrics::add(Metrics::IO_SYSCALLS);
+        int connection = ::accept4(source.file_descriptor, (sockaddr *)&event.address, &address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connection < 0)
+        {
+          break;
+        }
+        event.kind = IO_ACCEPTED;
+        event.tag = tag;
+        event.file_descriptor = connection;
+        event.error = 0;
+        event.flags = 0;
+        event.data = NULL;
+        event.length = 0;
+        count++;
+      }
+      continue;
+    }
+
+    if (source.kind == IO_SOURCE_DATAGRAMS)
+    {
+      int batch = max_events - count;
+      for (int j = 0; j < batch; j++)
+      {
+        iovecs[j] = iovec{.iov_base = &buffers[(size_t)(count + j) * IO_BUFFER_SIZE], .iov_len = IO_BUFFER_SIZE};
+        messages[j] = mmsghdr{};
+        messages[j].msg_hdr.msg_name = &events[count + j].address;
+        messages[j].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        messages[j].msg_hdr.msg_iov = &iovecs[j];
+        messages[j].msg_hdr.msg_iovlen = 1;
+      }
+      Metrics::add(Metrics::IO_SYSCALLS);
+      int received = ::recvmmsg(source.file_descriptor, messages.data(), batch, MSG_DONTWAIT, NULL);
+      for (int j = 0; j < received; j++)
+      {
+        io_event_t &event = events[count++];
+        event.kind = IO_DATAGRAM;
+        event.tag = tag;
+        event.file_descriptor = -1;
+        event.error = 0;
+        event.flags = messages[j].msg_hdr.msg_flags & MSG_TRUNC;
+        event.data = (const unsigned char *)iovecs[j].iov_base;
+        event.length = messages[j].msg_len;
+      }
+      continue;
+    }
+
+    if ((ready[i].events & EPOLLOUT) && !source.pending.empty())
+    {
+      if (!flush(source))
+      {
+        events[count++] = io_event_t{.kind = IO_CLOSED, .tag = tag, .file_descriptor = -1, .error = errno, .flags = 0, .data = NULL, .length = 0, .address = {}};
+        continue;
+      }
+      if (source.pending.empty())
+      {
+        epoll.modify(source.file_descriptor, EPOLLIN, tag);
+      }
+    }
+    if (!(ready[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+    {
+      continue;
+    }
+    unsigned char *buffer = &buffers[(size_t)count * IO_BUFFER_SIZE];
+    Metrics::add(Metrics::IO_SYSCALLS);
+    ssize_t received = ::recv(source.file_descriptor, buffer, IO_BUFFER_SIZE, MSG_DONTWAIT);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+      continue;
+    }
+    io_event_t &event = events[count++];
+    event = io_event_t{.kind = IO_RECEIVED, .tag = tag, .file_descriptor = -1, .error = 0, .flags = 0, .data = buffer, .length = (size_t)std::max<ssize_t>(received, 0), .address = {}};
+    if (received <= 0)
+    {
+      event.kind = IO_CLOSED;
+      event.error = received < 0 ? errno : 0;
+    }
+  }
+  return count;
+}
+
+#endif // IO_ENGINE_IMPLEMENTATION
@@ -0,0 +1,760 @@
+/*
+  io_uring engine for IoEngine, talking to the kernel through the raw syscalls and the shared rings
+  Listeners get one multishot accept and streams one multishot receive that stay armed until they end, so nothing is resubmitted per event
+  Receives pick their memory from a provided buffer ring, a buffer goes back to the ring on the wait after the one that handed it out
+  Streams are installed in a sparse registered file table, so requests on them skip the per call file lookup
+  Sends are copied into engine owned buffers and only reach the kernel with the next wait, so a whole tick of probes costs one io_uring_enter
+  A stream has one send in the kernel at a time and the rest queued behind it, so a short send is finished before the next one starts
+  create() returns nothing when the kernel lacks any of this, the caller then falls back to the epoll engine
+*/
+#ifndef IO_URING_H_
+#define IO_URING_H_
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+// Included at the end of the IoEngine.hpp declarations, which it builds on
+
+#define IO_URING_ENTRIES 1024
+#define IO_URING_BUFFERS 512 // in the provided buffer ring, a power of two
+#define IO_URING_BUFFER_GROUP 0
+#define IO_URING_FILES 16384 // registered file slots, streams beyond them use their plain descriptor
+#define IO_URING_SEND_CHUNK 256
+#define IO_URING_SEND_SIZE 256 // largest single send
+#define IO_URING_NO_SEND UINT32_MAX
+
+// What a request was for, kept in the low byte of its user data, the tag or send buffer index is in the rest
+enum UringOperation : uint8_t
+{
+  URING_ACCEPT = 1,
+  URING_RECEIVE,
+  URING_RECEIVE_DATAGRAMS,
+  URING_SEND,
+  URING_CANCEL,
+};
+
+typedef struct uring_source_t
+{
+  int file_descriptor;
+  int slot; // in the registered file table, -1 when the plain descriptor is used
+  UringOperation operation;
+  uint32_t send_head = IO_URING_NO_SEND; // the send in the kernel, followed by the queued ones
+  uint32_t send_tail = IO_URING_NO_SEND;
+  uint32_t queued = 0; // bytes not yet taken by the socket
+} uring_source_t;
+
+// A send in flight, the kernel reads the bytes from here until its completion arrives
+typedef struct uring_send_t
+{
+  uint64_t tag;
+  uint32_t length;
+  uint32_t offset; // bytes already taken by the socket, short sends are resubmitted from here
+  uint32_t next;   // queued behind this one on the same stream
+  int orphan_slot; // the stream was removed while this was in the kernel, -2 while it is still wanted
+  unsigned char data[IO_URING_SEND_SIZE];
+} uring_send_t;
+
+struct UringEngine : IoEngine
+{
+  ~UringEngine();
+
+  const char *name() const override;
+  int listen(int file_descriptor, uint64_t tag) override;
+  int receive(int file_descriptor, uint64_t tag) override;
+  int receive_datagrams(int file_descriptor, uint64_t tag) override;
+  int send(uint64_t tag, const void *data, size_t length) override;
+  void remove(uint64_t tag) override;
+  int wait(io_event_t *events, int max_events, int timeout_ms) override;
+
+  static std::unique_ptr<IoEngine> create();
+
+private:
+  int ring_fd = -1;
+  void *sq_ring = MAP_FAILED;
+  void *cq_ring = MAP_FAILED;
+  size_t sq_ring_size = 0;
+  size_t cq_ring_size = 0;
+  io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+  size_t sqes_size = 0;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_local_tail = 0; // sqes filled in but not yet handed to the kernel
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  io_uring_cqe *cqes;
+  std::vector<io_uring_cqe> stashed; // completions moved out of the ring to make room for submissions, handled first by the next wait
+  size_t stash_head = 0;
+
+  io_uring_buf *buffer_ring = (io_uring_buf *)MAP_FAILED; // the ring tail overlays the reserved field of the first entry
+  size_t buffer_ring_size = 0;
+  std::vector<unsigned char> buffer_memory;
+  uint16_t buffer_tail = 0;
+  std::vector<uint16_t> lent; // buffers handed out by the last wait
+
+  std::vector<int> free_slots;
+  std::vector<uint16_t> slot_holds; // requests still in the kernel for a removed stream, its slot is reused once they all completed
+  std::unordered_map<uint64_t, uring_source_t> sources;
+  std::vector<uint64_t> rearm; // multishot requests that ended while their source is still wanted
+  msghdr datagram_header = {};  // layout of multishot datagram buffers, read by the kernel for as long as the request is armed
+
+  std::vector<std::unique_ptr<uring_send_t[]>> send_chunks;
+  std::vector<uint32_t> free_sends;
+
+  int open();
+  int enter(unsigned to_submit, int timeout_ms);
+  int submit_queued();
+  int register_files(uint32_t offset, int file_descriptor);
+  io_uring_sqe *next_sqe();
+  void arm(uint64_t tag, const uring_source_t &source);
+  bool submit_send(uint32_t index);
+  uring_send_t &send_buffer(uint32_t index);
+  void drop_sends(uring_source_t &source, uint32_t first);
+  void release_slot(int slot);
+  void give_back(uint16_t buffer);
+  bool complete(const io_uring_cqe &cqe, io_event_t &event);
+};
+
+#endif // IO_URING_H_
+#ifdef IO_URING_IMPLEMENTATION
+
+static inline uint64_t uring_user_data(UringOperation operation, uint64_t key)
+{
+  return key << 8 | operation;
+}
+
+std::unique_ptr<IoEngine> UringEngine::create()
+{
+  std::unique_ptr<UringEngine> engine = std::make_unique<UringEngine>();
+  if (engine->open() < 0)
+  {
+    return nullptr;
+  }
+  return engine;
+}
+
+UringEngine::~UringEngine()
+{
+  if (ring_fd != -1)
+  {
+    ::close(ring_fd);
+  }
+  if (buffer_ring != MAP_FAILED)
+  {
+    munmap(buffer_ring, buffer_ring_size);
+  }
+  if (sqes != MAP_FAILED)
+  {
+    munmap(sqes, sqes_size);
+  }
+  if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+  {
+    munmap(cq_ring, cq_ring_size);
+  }
+  if (sq_ring != MAP_FAILED)
+  {
+    munmap(sq_ring, sq_ring_size);
+  }
+}
+
+const char *UringEngine::name() const
+{
+  return "io_uring";
+}
+
+int UringEngine::open()
+{
+  io_uring_params params = {};
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER;
+  params.cq_entries = IO_URING_ENTRIES * 4;
+  ring_fd = syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+  if (ring_fd < 0 && errno == EINVAL)
+  {
+    // Older kernels reject the newer flags, the engine does not depend on them
+    params = {};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = IO_URING_ENTRIES * 4;
+    ring_fd = syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+  }
+  if (ring_fd < 0)
+  {
+    return -1;
+  }
+  if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG))
+  {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+  sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED)
+  {
+    return -1;
+  }
+  cq_ring = sq_ring;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+    {
+      return -1;
+    }
+  }
+  sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  sqes = (io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+  {
+    return -1;
+  }
+  unsigned char *sq = (unsigned char *)sq_ring;
+  unsigned char *cq = (unsigned char *)cq_ring;
+  sq_head = (unsigned *)(sq + params.sq_off.head);
+  sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  sq_array = (unsigned *)(sq + params.sq_off.array);
+  sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  sq_entries = params.sq_entries;
+  sq_local_tail = *sq_tail;
+  cq_head = (unsigned *)(cq + params.cq_off.head);
+  cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  // Every opcode the engine submits has to be there, multishot support comes with the buffer ring checked below
+  size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+  std::vector<unsigned char> probe_memory(probe_size);
+  io_uring_probe *probe = (io_uring_probe *)probe_memory.data();
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+  {
+    return -1;
+  }
+  for (int operation : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_RECVMSG, IORING_OP_SEND, IORING_OP_ASYNC_CANCEL})
+  {
+    if (operation > probe->last_op || !(probe->ops[operation].flags & IO_URING_OP_SUPPORTED))
+    {
+      errno = ENOSYS;
+      return -1;
+    }
+  }
+
+  buffer_ring_size = (IO_URING_BUFFERS * sizeof(io_uring_buf) + sysconf(_SC_PAGESIZE) - 1) & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+  buffer_ring = (io_uring_buf *)mmap(NULL, buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer_ring == MAP_FAILED)
+  {
+    return -1;
+  }
+  io_uring_buf_reg buffer_registration = {};
+  buffer_registration.ring_addr = (uint64_t)buffer_ring;
+  buffer_registration.ring_entries = IO_URING_BUFFERS;
+  buffer_registration.bgid = IO_URING_BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &buffer_registration, 1) < 0)
+  {
+    return -1;
+  }
+  buffer_memory.resize((size_t)IO_URING_BUFFERS * IO_BUFFER_SIZE);
+  for (uint16_t buffer = 0; buffer < IO_URING_BUFFERS; buffer++)
+  {
+    lent.push_back(buffer);
+  }
+
+  // Not fatal, streams keep their plain descriptor without it
+  io_uring_rsrc_register files = {};
+  files.nr = IO_URING_FILES;
+  files.flags = IORING_RSRC_REGISTER_SPARSE;
+  bool fixed_files = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES2, &files, sizeof(files)) == 0;
+  if (fixed_files)
+  {
+    slot_holds.resize(IO_URING_FILES);
+    for (int slot = IO_URING_FILES - 1; slot >= 0; slot--)
+    {
+      free_slots.push_back(slot);
+    }
+  }
+
+  datagram_header.msg_namelen = sizeof(sockaddr_in);
+  return ring_fd;
+}
+
+// Hands queued entries to the kernel and reaps, waiting for a first completion unless timeout_ms is 0
+int UringEngine::enter(unsigned to_submit, int timeout_ms)
+{
+  timespec timeout = {.tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L};
+  io_uring_getevents_arg argument = {};
+  argument.sigmask_sz = _NSIG / 8;
+  argument.ts = timeout_ms >= 0 ? (uint64_t)&timeout : 0;
+  unsigned min_complete = timeout_ms != 0 ? 1 : 0;
+  Metrics::add(Metrics::IO_SYSCALLS);
+  int result = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &argument, sizeof(argument));
+  if (result >= 0)
+  {
+    return result;
+  }
+  // Running out of time or being interrupted is a normal end of a wait
+  return errno == ETIME || errno == EINTR || errno == EBUSY ? 0 : -1;
+}
+
+int UringEngine::register_files(uint32_t offset, int file_descriptor)
+{
+  io_uring_files_update update = {};
+  update.offset = offset;
+  update.fds = (uint64_t)&file_descriptor;
+  Metrics::add(Metrics::IO_SYSCALLS);
+  return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
+
+// Hands every queued entry to the kernel without waiting
+// The kernel refuses submissions while its completion queue is backed up, so completions are stashed until the head moves
+int UringEngine::submit_queued()
+{
+  __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+  unsigned submitted_head;
+  while ((submitted_head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE)) != sq_local_tail)
+  {
+    if (enter(sq_local_tail - submitted_head, 0) < 0)
+    {
+      perror("io_uring submit");
+      return -1;
+    }
+    if (__atomic_load_n(sq_head, __ATOMIC_ACQUIRE) != submitted_head)
+    {
+      continue;
+    }
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+      stashed.push_back(cqes[head & cq_mask]);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+// A cleared submission entry, handing the queued ones to the kernel first when the ring is full
+// NULL only when the ring itself failed
+io_uring_sqe *UringEngine::next_sqe()
+{
+  if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries && submit_queued() < 0)
+  {
+    return NULL;
+  }
+  unsigned index = sq_local_tail & sq_mask;
+  io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array[index] = index;
+  sq_local_tail++;
+  return sqe;
+}
+
+void UringEngine::arm(uint64_t tag, const uring_source_t &source)
+{
+  io_uring_sqe *sqe = next_sqe();
+  if (sqe == NULL)
+  {
+    return;
+  }
+  sqe->user_data = uring_user_data(source.operation, tag);
+  sqe->fd = source.slot != -1 ? source.slot : source.file_descriptor;
+  sqe->flags = source.slot != -1 ? IOSQE_FIXED_FILE : 0;
+  if (source.operation == URING_ACCEPT)
+  {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    return;
+  }
+  sqe->opcode = source.operation == URING_RECEIVE ? IORING_OP_RECV : IORING_OP_RECVMSG;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = IO_URING_BUFFER_GROUP;
+  if (source.operation == URING_RECEIVE_DATAGRAMS)
+  {
+    sqe->addr = (uint64_t)&datagram_header;
+    sqe->len = 1;
+  }
+}
+
+int UringEngine::listen(int file_descriptor, uint64_t tag)
+{
+  uring_source_t &source = sources[tag] = uring_source_t{.file_descriptor = file_descriptor, .slot = -1, .operation = URING_ACCEPT};
+  arm(tag, source);
+  return 0;
+}
+
+int UringEngine::receive(int file_descriptor, uint64_t tag)
+{
+  int slot = -1;
+  if (!free_slots.empty() && register_files(free_slots.back(), file_descriptor) == 1)
+  {
+    slot = free_slots.back();
+    free_slots.pop_back();
+  }
+  uring_source_t &source = sources[tag] = uring_source_t{.file_descriptor = file_descriptor, .slot = slot, .operation = URING_RECEIVE};
+  arm(tag, source);
+  return 0;
+}
+
+int UringEngine::receive_datagrams(int file_descriptor, uint64_t tag)
+{
+  uring_source_t &source = sources[tag] = uring_source_t{.file_descriptor = file_descriptor, .slot = -1, .operation = URING_RECEIVE_DATAGRAMS};
+  arm(tag, source);
+  return 0;
+}
+
+uring_send_t &UringEngine::send_buffer(uint32_t index)
+{
+  return send_chunks[index / IO_URING_SEND_CHUNK][index % IO_URING_SEND_CHUNK];
+}
+
+bool UringEngine::submit_send(uint32_t index)
+{
+  uring_send_t &buffer = send_buffer(index);
+  const uring_source_t &source = sources[buffer.tag];
+  io_uring_sqe *sqe = next_sqe();
+  if (sqe == NULL)
+  {
+    errno = EIO;
+    return false;
+  }
+  sqe->opcode = IORING_OP_SEND;
+  sqe->user_data = uring_user_data(URING_SEND, index);
+  sqe->fd = source.slot != -1 ? source.slot : source.file_descriptor;
+  sqe->flags = source.slot != -1 ? IOSQE_FIXED_FILE : 0;
+  sqe->addr = (uint64_t)(buffer.data + buffer.offset);
+  sqe->len = buffer.length - buffer.offset;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  return true;
+}
+
+int UringEngine::send(uint64_t tag, const void *data, size_t length)
+{
+  auto it = sources.find(tag);
+  if (it == sources.end() || it->second.operation != URING_RECEIVE)
+  {
+    errno = EBADF;
+    return -1;
+  }
+  if (length > IO_URING_SEND_SIZE)
+  {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  // Buffers come in chunks that never move, the kernel holds on to their address
+  if (free_sends.empty())
+  {
+    uint32_t first = send_chunks.size() * IO_URING_SEND_CHUNK;
+    send_chunks.push_back(std::make_unique<uring_send_t[]>(IO_URING_SEND_CHUNK));
+    for (uint32_t index = first + IO_URING_SEND_CHUNK; index > first; index--)
+    {
+      free_sends.push_back(index - 1);
+    }
+  }
+  uring_source_t &source = it->second;
+  if (source.queued + length > IO_PENDING_MAX)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+  uint32_t index = free_sends.back();
+  uring_send_t &buffer = send_buffer(index);
+  buffer.tag = tag;
+  buffer.length = length;
+  buffer.offset = 0;
+  buffer.next = IO_URING_NO_SEND;
+  buffer.orphan_slot = -2;
+  memcpy(buffer.data, data, length);
+  // Only the first send of a stream goes to the kernel, the others wait for it to complete
+  if (source.send_head == IO_URING_NO_SEND)
+  {
+    if (!submit_send(index))
+    {
+      return -1;
+    }
+    source.send_head = index;
+  }
+  else
+  {
+    send_buffer(source.send_tail).next = index;
+  }
+  source.send_tail = index;
+  source.queued += length;
+  free_sends.pop_back();
+  return 0;
+}
+
+// Frees first and everything queued behind it on the stream
+void UringEngine::drop_sends(uring_source_t &source, uint32_t first)
+{
+  for (uint32_t index = first; index != IO_URING_NO_SEND; index = send_buffer(index).next)
+  {
+    free_sends.push_back(index);
+  }
+  source.send_head = source.send_tail = IO_URING_NO_SEND;
+  source.queued = 0;
+}
+
+void UringEngine::release_slot(int slot)
+{
+  if (slot >= 0 && --slot_holds[slot] == 0)
+  {
+    free_slots.push_back(slot);
+  }
+}
+
+void UringEngine::remove(uint64_t tag)
+{
+  auto it = sources.find(tag);
+  if (it == sources.end())
+  {
+    return;
+  }
+  uring_source_t &source = it->second;
+  // A send may still sit in the submission queue naming the slot, so the slot is only reused after that send and the cancel completed
+  // Emptying it right away lets the descriptor close, whatever still names the slot then fails instead of reaching another stream
+  if (source.slot != -1)
+  {
+    register_files(source.slot, -1);
+    slot_holds[source.slot] = 1;
+  }
+  if (source.send_head != IO_URING_NO_SEND)
+  {
+    uring_send_t &sending = send_buffer(source.send_head);
+    sending.orphan_slot = source.slot;
+    if (source.slot != -1)
+    {
+      slot_holds[source.slot]++;
+    }
+    drop_sends(source, sending.next);
+    // A plain descriptor is looked up when the send is submitted, which has to happen before the caller closes it and the number is reused
+    if (source.slot == -1)
+    {
+      submit_queued();
+    }
+  }
+  // Completions already queued for the tag are dropped once it is gone
+  io_uring_sqe *sqe = next_sqe();
+  if (sqe != NULL)
+  {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = uring_user_data(source.operation, tag);
+    sqe->user_data = uring_user_data(URING_CANCEL, (uint32_t)source.slot);
+  }
+  else
+  {
+    release_slot(source.slot);
+  }
+  sources.erase(it);
+}
+
+void UringEngine::give_back(uint16_t buffer)
+{
+  io_uring_buf &entry = buffer_ring[buffer_tail & (IO_URING_BUFFERS - 1)];
+  entry.addr = (uint64_t)&buffer_memory[(size_t)buffer * IO_BUFFER_SIZE];
+  entry.len = IO_BUFFER_SIZE;
+  entry.bid = buffer;
+  buffer_tail++;
+}
+
+// Turns one completion into an event, false when it only concerned the engine
+bool UringEngine::complete(const io_uring_cqe &cqe, io_event_t &event)
+{
+  UringOperation operation = (UringOperation)(cqe.user_data & 0xff);
+  uint64_t key = cqe.user_data >> 8;
+  bool more = cqe.flags & IORING_CQE_F_MORE;
+  int buffer = cqe.flags & IORING_CQE_F_BUFFER ? (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+  if (buffer != -1)
+  {
+    lent.push_back(buffer);
+  }
+
+  if (operation == URING_SEND)
+  {
+    uring_send_t &sent = send_buffer(key);
+    if (sent.orphan_slot != -2)
+    {
+      free_sends.push_back(key);
+      release_slot(sent.orphan_slot);
+      return false;
+    }
+    // Only the head of a stream is ever in the kernel, so the source is still there
+    uring_source_t &source = sources[sent.tag];
+    int error = cqe.res < 0 ? -cqe.res : 0;
+    if (cqe.res >= 0)
+    {
+      sent.offset += cqe.res;
+      source.queued -= cqe.res;
+      uint32_t index = sent.offset < sent.length ? key : sent.next;
+      if (index != key)
+      {
+        free_sends.push_back(key);
+        source.send_head = index;
+      }
+      if (index == IO_URING_NO_SEND)
+      {
+        source.send_tail = IO_URING_NO_SEND;
+        return false;
+      }
+      if (submit_send(index))
+      {
+        return false;
+      }
+      error = errno;
+      key = index;
+    }
+    // The stream is reported closed once, whatever was queued behind the failed send is dropped with it
+    uint64_t tag = sent.tag;
+    drop_sends(source, key);
+    event = io_event_t{.kind = IO_CLOSED, .tag = tag, .file_descriptor = -1, .error = error, .flags = 0, .data = NULL, .length = 0, .address = {}};
+    return true;
+  }
+  if (operation == URING_CANCEL)
+  {
+    release_slot((int32_t)key);
+    return false;
+  }
+
+  auto it = sources.find(key);
+  if (it == sources.end())
+  {
+    if (operation == URING_ACCEPT && cqe.res >= 0)
+    {
+      ::close(cqe.res);
+    }
+    return false;
+  }
+  // A multishot request that stopped is armed again on the next wait, unless the stream itself ended
+  bool ended = operation == URING_RECEIVE && (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS));
+  if (!more && !ended)
+  {
+    rearm.push_back(key);
+  }
+  if (cqe.res < 0 && !ended)
+  {
+    return false;
+  }
+
+  event = io_event_t{.kind = IO_CLOSED, .tag = key, .file_descriptor = -1, .error = 0, .flags = 0, .data = NULL, .length = 0, .address = {}};
+  if (operation == URING_ACCEPT)
+  {
+    event.kind = IO_ACCEPTED;
+    event.file_descriptor = cqe.res;
+    socklen_t address_length = sizeof(event.address);
+    Metrics::add(Metrics::IO_SYSCALLS);
+    getpeername(cqe.res, (sockaddr *)&event.address, &address_length);
+    return true;
+  }
+  if (ended)
+  {
+    event.error = -cqe.res;
+    return true;
+  }
+  if (buffer == -1)
+  {
+    return false;
+  }
+  unsigned char *data = &buffer_memory[(size_t)buffer * IO_BUFFER_SIZE];
+  if (operation == URING_RECEIVE)
+  {
+    event.kind = IO_RECEIVED;
+    event.data = data;
+    event.length = cqe.res;
+    return true;
+  }
+  // Datagram buffers start with a header, then the sender address, then the payload
+  io_uring_recvmsg_out header;
+  memcpy(&header, data, sizeof(header));
+  size_t payload = sizeof(header) + datagram_header.msg_namelen + datagram_header.msg_controllen;
+  if ((size_t)cqe.res < payload)
+  {
+    return false;
+  }
+  event.kind = IO_DATAGRAM;
+  memcpy(&event.address, data + sizeof(header), std::min<size_t>(header.namelen, sizeof(event.address)));
+  event.flags = header.flags & MSG_TRUNC;
+  event.data = data + payload;
+  event.length = cqe.res - payload;
+  return true;
+}
+
+int UringEngine::wait(io_event_t *events, int max_events, int timeout_ms)
+{
+  // Whatever the previous wait handed out is no longer looked at
+  for (uint16_t buffer : lent)
+  {
+    give_back(buffer);
+  }
+  if (!lent.empty())
+  {
+    __atomic_store_n(&buffer_ring[0].resv, buffer_tail, __ATOMIC_RELEASE);
+    lent.clear();
+  }
+  // Arming only queues entries, nothing in here completes and adds to rearm
+  for (uint64_t tag : rearm)
+  {
+    auto it = sources.find(tag);
+    if (it != sources.end())
+    {
+      arm(tag, it->second);
+    }
+  }
+  rearm.clear();
+
+  __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+  unsigned to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  bool ready = stash_head < stashed.size() || __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head;
+  if ((to_submit > 0 || !ready) && enter(to_submit, ready ? 0 : timeout_ms) < 0)
+  {
+    return -1;
+  }
+
+  // Each completion is copied and released before it is handled, a resubmitted send may stash the rest of the ring
+  int count = 0;
+  while (stash_head < stashed.size() && count < max_events)
+  {
+    io_uring_cqe cqe = stashed[stash_head++];
+    if (complete(cqe, events[count]))
+    {
+      count++;
+    }
+  }
+  if (stash_head == stashed.size())
+  {
+    stashed.clear();
+    stash_head = 0;
+  }
+  while (count < max_events)
+  {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+      break;
+    }
+    io_uring_cqe cqe = cqes[head & cq_mask];
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    if (complete(cqe, events[count]))
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+#endif // IO_URING_IMPLEMENTATION
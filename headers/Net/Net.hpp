@@ -209,14 +209,14 @@ namespace Net
   struct NetworkInterfaceList
   {
   public:
-    NetworkInterfaceList(ifaddrs *addrs) : _ifaddrs(addrs), free(false) {}
-    NetworkInterfaceList(ifaddrs &addrs) : _ifaddrs(std::addressof(addrs)), free(false) {}
-    NetworkInterfaceList(ifaddrs &&addrs) : _ifaddrs(std::addressof(addrs)), free(true) {}
+    NetworkInterfaceList(ifaddrs *addrs) : _head(addrs), _ifaddrs(addrs), free(false) {}
+    NetworkInterfaceList(ifaddrs &addrs) : _head(std::addressof(addrs)), _ifaddrs(std::addressof(addrs)), free(false) {}
+    NetworkInterfaceList(ifaddrs &&addrs) : _head(std::addressof(addrs)), _ifaddrs(std::addressof(addrs)), free(true) {}
     ~NetworkInterfaceList()
     {
-      if (free)
+      if (free && _head)
       {
-        freeifaddrs(_ifaddrs);
+        freeifaddrs(_head);
       }
     }
 
@@ -234,6 +234,7 @@ namespace Net
     NetworkInterfaceList operator++(int)
     {
       NetworkInterfaceList iterator = *this;
+      iterator.free = false;
       ++*this;
       return iterator;
     }
@@ -264,26 +265,41 @@ namespace Net
     }
 
   private:
+    ifaddrs *_head;
     ifaddrs *_ifaddrs;
     NetworkInterface _current;
     bool free;
-    NetworkInterfaceList() : _ifaddrs(nullptr), free(true)
+    NetworkInterfaceList() : _head(nullptr), _ifaddrs(nullptr), free(true)
     {
       if (getifaddrs(&_ifaddrs) == -1)
       {
         perror("getifaddrs");
+        _ifaddrs = nullptr;
         return;
       }
+      _head = _ifaddrs;
     }
   };
+
+  // What broadcasting needs from an interface, copied out of getifaddrs so it outlives the list
+  struct BroadcastInterface
+  {
+    string name;
+    in_addr_t address;   // network order
+    in_addr_t broadcast; // network order, the directed broadcast address of the interface subnet
+  };
+
+  // Up, broadcast capable, non loopback IPv4 interfaces, enumerated on the first call and cached afterwards
+  const std::vector<BroadcastInterface> &broadcast_interfaces();
 }
 #endif // NET_H_
 #ifdef NET_IMPLEMENTATION
 namespace InternetAddress
 {
-  const Net::Address Any = Net::Address{htonl(INADDR_ANY)};
-  const Net::Address Broadcast = Net::Address{htonl(INADDR_BROADCAST)};
-  const Net::Address Loopback = Net::Address{htonl(INADDR_LOOPBACK)};
+  // Address(in_addr_t) takes host order and swaps on its own
+  const Net::Address Any = Net::Address{(in_addr_t)INADDR_ANY};
+  const Net::Address Broadcast = Net::Address{(in_addr_t)INADDR_BROADCAST};
+  const Net::Address Loopback = Net::Address{(in_addr_t)INADDR_LOOPBACK};
 };
 namespace Net
 {
@@ -382,6 +398,31 @@ namespace Net
     destination_address = addrs.ifa_dstaddr;
     interface_data = addrs.ifa_data;
   }
+
+  const std::vector<BroadcastInterface> &broadcast_interfaces()
+  {
+    static const std::vector<BroadcastInterface> cached = []()
+    {
+      std::vector<BroadcastInterface> interfaces;
+      for (auto it = NetworkInterfaceList::begin(); it != NetworkInterfaceList::end(); ++it)
+      {
+        const NetworkInterface &network_interface = *it;
+        bool usable = (network_interface.flags & IFF_UP) && (network_interface.flags & IFF_BROADCAST) &&
+                      !(network_interface.flags & IFF_LOOPBACK);
+        if (!usable || !network_interface.network_address || network_interface.network_address->sa_family != AF_INET ||
+            !network_interface.broadcast_address)
+        {
+          continue;
+        }
+        interfaces.push_back(BroadcastInterface{
+            .name = string(network_interface.interface_name),
+            .address = ((const sockaddr_in *)network_interface.network_address)->sin_addr.s_addr,
+            .broadcast = ((const sockaddr_in *)network_interface.broadcast_address)->sin_addr.s_addr});
+      }
+      return interfaces;
+    }();
+    return cached;
+  }
 }
 #endif // NET_IMPLEMENTATION
 
@@ -1,6 +1,7 @@
 /*
   Adpats the posix socket api to a more c++ like api
   This implementation does not declare copy constructors to avoid stale file descriptors and unwanted destruction on copies
+  The buffer overloads read and write caller owned memory directly, the string overloads reuse the capacity of the string they are given
 */
 
 #ifndef SOCKET_H_
@@ -13,9 +14,13 @@
 #include <mutex>
 #include <condition_variable>
 #include <poll.h>
+#include <algorithm>
+#include <sys/socket.h>
 #include "Net.hpp"
 #include "./../FileDescriptor.hpp"
 
+#define SOCKET_RECV_SIZE 1024
+
 struct Socket : FileDescriptor
 {
   Socket(Socket &&other) : FileDescriptor(static_cast<FileDescriptor &&>(other)) {}
@@ -36,13 +41,19 @@ public:
   int recv(string *payload, int flags = 0);
   int send(const string &payload, const IpEndpoint &ep, int flags = 0);
   int recv(string *payload, IpEndpoint &ep, int flags = 0);
+  int send(const void *buffer, size_t length, int flags = 0);
+  int recv(void *buffer, size_t length, int flags = 0);
+  int send(const void *buffer, size_t length, const IpEndpoint &ep, int flags = 0);
+  int recv(void *buffer, size_t length, IpEndpoint &ep, int flags = 0);
+  int send_batch(mmsghdr *messages, unsigned int count, int flags = 0);
+  int recv_batch(mmsghdr *messages, unsigned int count, int flags = 0);
   int close();
   int bind(int port);
   int bind(const IpEndpoint &ep);
   int bind(Address address, int port);
   int bind(string address, int port);
   int listen(int backlog = 5);
-  Socket accept(IpEndpoint &ep);
+  Socket accept(IpEndpoint &ep, int flags = 0);
 
   constexpr Socket &operator=(Socket &&other);
 };
@@ -109,19 +120,69 @@ int Socket::connect(const string &ip, int port)
 
 int Socket::send(const string &payload, int flags)
 {
-  return ::send(file_descriptor, payload.c_str(), payload.size(), flags);
+  return send(payload.data(), payload.size(), flags);
 }
 
 int Socket::recv(string *payload, int flags)
 {
-  char buffer[1024] = {0};
-  int bytesReceived = ::recv(file_descriptor, buffer, 1024, flags);
-  if (bytesReceived < 0)
+  payload->resize(std::max<size_t>(payload->capacity(), SOCKET_RECV_SIZE));
+  int bytes_received = recv(payload->data(), payload->size(), flags);
+  payload->resize(bytes_received < 0 ? 0 : bytes_received);
+  return bytes_received;
+}
+
+int Socket::send(const void *buffer, size_t length, int flags)
+{
+  int result;
+  do
+  {
+    result = ::send(file_descriptor, buffer, length, flags);
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
+
+int Socket::recv(void *buffer, size_t length, int flags)
+{
+  int result;
+  do
+  {
+    result = ::recv(file_descriptor, buffer, length, flags);
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
+
+int Socket::send(const void *buffer, size_t length, const IpEndpoint &ep, int flags)
+{
+  int result;
+  do
+  {
+    result = ::sendto(file_descriptor, buffer, length, flags, &ep.socket_address, ep.address_length);
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
+
+// For datagram sockets a datagram larger than the buffer is an error instead of being silently cut
+// The kernel reports the cut in msg_flags, stream sockets never set it so their unread bytes stay queued
+int Socket::recv(void *buffer, size_t length, IpEndpoint &ep, int flags)
+{
+  iovec buffer_iovec = {.iov_base = buffer, .iov_len = length};
+  msghdr message = {};
+  message.msg_name = &ep.socket_address;
+  message.msg_namelen = sizeof(ep.socket_address);
+  message.msg_iov = &buffer_iovec;
+  message.msg_iovlen = 1;
+  int result;
+  do
   {
+    result = ::recvmsg(file_descriptor, &message, flags);
+  } while (result < 0 && errno == EINTR);
+  ep.address_length = message.msg_namelen;
+  if (result >= 0 && (message.msg_flags & MSG_TRUNC))
+  {
+    errno = EMSGSIZE;
     return -1;
   }
-  *payload = string(buffer, bytesReceived);
-  return bytesReceived;
+  return result;
 }
 
 int Socket::close()
@@ -172,9 +233,9 @@ int Socket::listen(int backlog)
   return ::listen(file_descriptor, backlog);
 }
 
-Socket Socket::accept(IpEndpoint &ep)
+Socket Socket::accept(IpEndpoint &ep, int flags)
 {
-  int client_socket = ::accept(file_descriptor, (struct sockaddr *)&ep.socket_address, &ep.address_length);
+  int client_socket = ::accept4(file_descriptor, (struct sockaddr *)&ep.socket_address, &ep.address_length, flags);
   if (client_socket < 0)
   {
     return Socket{};
@@ -184,19 +245,44 @@ Socket Socket::accept(IpEndpoint &ep)
 
 int Socket::recv(string *payload, IpEndpoint &ep, int flags)
 {
-  char buffer[1024]{};
-  int bytes_received = ::recvfrom(file_descriptor, buffer, 1024, flags, &ep.socket_address, &ep.address_length);
-  if (bytes_received < 0)
-  {
-    return -1;
-  }
-  *payload = string(buffer, bytes_received);
+  payload->resize(std::max<size_t>(payload->capacity(), SOCKET_RECV_SIZE));
+  int bytes_received = recv(payload->data(), payload->size(), ep, flags);
+  payload->resize(bytes_received < 0 ? 0 : bytes_received);
   return bytes_received;
 }
 
 int Socket::send(const string &payload, const IpEndpoint &ep, int flags)
 {
-  return ::sendto(file_descriptor, payload.c_str(), payload.size(), flags, &ep.socket_address, ep.address_length);
+  return send(payload.data(), payload.size(), ep, flags);
+}
+
+int Socket::send_batch(mmsghdr *messages, unsigned int count, int flags)
+{
+  unsigned int sent = 0;
+  while (sent < count)
+  {
+    int result = ::sendmmsg(file_descriptor, messages + sent, count - sent, flags);
+    if (result < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return sent > 0 ? (int)sent : -1;
+    }
+    sent += result;
+  }
+  return sent;
+}
+
+int Socket::recv_batch(mmsghdr *messages, unsigned int count, int flags)
+{
+  int result;
+  do
+  {
+    result = ::recvmmsg(file_descriptor, messages, count, flags, NULL);
+  } while (result < 0 && errno == EINTR);
+  return result;
 }
 
 int Socket::connect(const IpEndpoint &ep)
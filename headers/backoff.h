@@ -0,0 +1,37 @@
+/*
+  Capped exponential backoff with full jitter
+  Every retry waits a uniformly random time between zero and the current ceiling, and the ceiling doubles up to a cap
+  Spreading the retries over the whole window keeps a fleet that failed at the same moment from retrying in lockstep
+*/
+#ifndef BACKOFF_H_
+#define BACKOFF_H_
+
+#include <stdint.h>
+#include <random>
+#include <algorithm>
+
+struct Backoff
+{
+  int64_t base_ms;
+  int64_t cap_ms;
+  int64_t ceiling_ms;
+  std::minstd_rand random;
+
+  Backoff(int64_t base_ms, int64_t cap_ms, uint64_t seed) : base_ms(base_ms), cap_ms(cap_ms), ceiling_ms(base_ms), random(seed % 2147483646 + 1) {}
+
+  // How long to wait before the next attempt
+  int64_t next_delay()
+  {
+    int64_t delay = std::uniform_int_distribution<int64_t>(0, ceiling_ms)(random);
+    ceiling_ms = std::min(ceiling_ms * 2, cap_ms);
+    return delay;
+  }
+
+  // Back to the fastest rate, for when the other side is known to be there
+  void reset()
+  {
+    ceiling_ms = base_ms;
+  }
+};
+
+#endif // BACKOFF_H_
@@ -12,6 +12,8 @@
 #include <mutex>
 #include "macros.h"
 #include "management.hpp"
+#include "wake_on_lan.h"
+#include "metrics.h"
 
 typedef void *(*Callback)(void *);
 typedef struct Command
@@ -34,17 +36,20 @@ extern Command commands[COMMAND_COUNT];
 
 void *help_msg_server();
 void *help_msg_client();
+string help_text_server();
 int command_exec(ParticipantTable &participants);
 
 #endif // COMMANDS_H_
 #ifdef COMMANDS_IMPLEMENTATION
 
+WakeOnLanSender wake_on_lan;
+
 Command commands[COMMAND_COUNT] = {
     // clang-format off
     [COMMAND_WAKE_ON_LAN] = Command{
       cmd : "WAKEUP",
-      description : "Sends a magic packet to the client to wake it up",
-      fmt : "%d",
+      description : "Sends a magic packet to the clients to wake them up",
+      fmt : "%s",
       callback : NULL
     }
     // clang-format on
@@ -75,10 +80,15 @@ void *exit_program(void *args)
   return NULL;
 }
 
+string help_text_server()
+{
+  return "[COMMAND]\tWAKEUP <hostname> [hostname...]\n"
+         "[DESCRIPTION]\tSends a WoL packet to every <hostname> connected to the service.\n\n";
+}
+
 void *help_msg_server()
 {
-  printf("%s", "[COMMAND]\tWAKEUP <hostname>\n");
-  printf("%s", "[DESCRIPTION]\tSends a WoL packet to <hostname> connected to the service.\n\n");
+  printf("%s", help_text_server().c_str());
 
   return NULL;
 }
@@ -95,7 +105,11 @@ int command_exec(ParticipantTable &participants)
 {
   int exit_code = 0;
   char buffer[MAXLINE];
-  fgets(buffer, MAXLINE, stdin);
+  if (fgets(buffer, MAXLINE, stdin) == NULL)
+  {
+    return -1;
+  }
+  int64_t started_us = monotonic_us();
   ssize_t read = strlen(buffer);
   string cmd = string(buffer).substr(0, read);
   trim(cmd);
@@ -107,26 +121,45 @@ int command_exec(ParticipantTable &participants)
   {
     string cmd_args = string(cmd).substr(commands[cmd_type].cmd.size());
     trim(cmd_args);
-    auto host_name = string(cmd_args).substr(0, cmd_args.find(" "));
-    auto it = participants.map.find(host_name);
-    if (it == participants.map.end())
+    auto snapshot = participants.snapshot();
+    std::vector<MacAddress> macs;
+    size_t cursor = 0;
+    while (cursor < cmd_args.size())
     {
-        std::cerr << "[ERROR] Invalid Hostname" << std::endl;
-        break;
+      size_t separator = cmd_args.find(' ', cursor);
+      if (separator == string::npos)
+      {
+        separator = cmd_args.size();
+      }
+      auto host_name = cmd_args.substr(cursor, separator - cursor);
+      cursor = separator + 1;
+      if (host_name.empty())
+      {
+        continue;
+      }
+      const participant_t *participant = snapshot->find(host_name);
+      if (participant == nullptr)
+      {
+        Metrics::add(Metrics::COMMAND_ERRORS);
+        std::cerr << "[ERROR] Invalid Hostname " << host_name << std::endl;
+        continue;
+      }
+      macs.push_back(participant->machine.mac);
     }
-    const auto &[host, participant] = *it;
-    string magic_packet = "wakeonlan " + std::string(participant.machine.mac.mac_str);
-    if (system(magic_packet.c_str()) < 0)
+    if (!macs.empty() && wake_on_lan.wake(macs) < 0)
     {
       perrorcode("wakeonlan");
     }
     break;
   }
   default:
+    Metrics::add(Metrics::COMMAND_ERRORS);
     std::cerr << "[ERROR] Invalid command " << cmd << std::endl;
     goto finally;
   }
 finally:
+  Metrics::add(Metrics::COMMANDS_EXECUTED);
+  Metrics::record(Metrics::COMMAND_LATENCY_US, monotonic_us() - started_us);
   return exit_code;
 }
 
@@ -2,6 +2,13 @@
   This service is used to discover other services on the local network
   It used UDP broadcasts to discover other services
   The client sends a packet containing a header its hostname and its mac address and waits for the server to respond with a header to then collect the endpoint of the server
+  The server remembers every mac address it handed to the main loop for DISCOVERY_SEEN_TTL_MS, so repeated broadcasts are only answered
+  A known mac address arriving from another address is handed over again, and each mac address gets at most one reply per DISCOVERY_REPLY_INTERVAL_MS
+  The client backs off exponentially with full jitter while nobody answers, so a fleet without a manager stays quiet
+  The manager announces itself every DISCOVERY_ANNOUNCE_INTERVAL_MS and a client that hears it drops back to the fastest rate
+  The server answers hellos and announces itself from two coroutines sharing one thread (see Async.hpp)
+  Both sides send directed broadcasts on every broadcast capable interface at once, each client hello carrying the mac address of the card it left from
+  Hosts without such an interface fall back to the limited broadcast address
 */
 #ifndef DISCOVERY_SERVICE_H_
 #define DISCOVERY_SERVICE_H_
@@ -21,21 +28,55 @@
 #include <unistd.h>
 #include <vector>
 #include <pthread.h>
+#include <poll.h>
+#include "Async.hpp"
+#include "backoff.h"
 #include "commands.hpp"
+#include "EventFd.hpp"
 #include "macros.h"
-#include "DataStructures/LockFreeQueue.h"
+#include "metrics.h"
+#include "DataStructures/RingQueue.h"
+#include "DataStructures/SeenSet.h"
 
 using string = std::string;
 using string_view = std::string_view;
 #define HOSTNAME_LEN 1024
+#define DISCOVERY_BATCH 64
+#define DISCOVERY_PACKET_MAX 1024
+#define DISCOVERY_IDLE_TIMEOUT_MS 1000
+#define DISCOVERY_QUEUE_CAPACITY 1024
+#define DISCOVERY_SEEN_CAPACITY 1024
+#define DISCOVERY_SEEN_TTL_MS 30000
+#define DISCOVERY_REPLY_INTERVAL_MS 500
+#define DISCOVERY_ANNOUNCE_INTERVAL_MS 1000
+#define DISCOVERY_BACKOFF_BASE_MS 100
+#define DISCOVERY_BACKOFF_CAP_MS 30000
+
+// One interface the client broadcasts its hello on, replies come back to the same socket
+typedef struct discovery_link_t
+{
+    Socket socket;
+    IpEndpoint target;
+    string packet;
+} discovery_link_t;
+
+// What the server remembers about a mac address it already handed to the main loop
+typedef struct discovery_seen_t
+{
+    in_addr_t address;
+    int64_t replied_ms;
+} discovery_seen_t;
 
 struct DiscoveryService
 {
     pthread_t thread;
-    bool running;
-    int port;
+    bool joinable = false; // a thread was started and not joined yet
+    bool running = false;
+    int port = 0;
     Socket udp_socket;
-    Concurrent::LockFreeQueue<MachineEndpoint> endpoints = {};
+    // Discovery thread -> main loop handoff
+    Concurrent::RingQueue<MachineEndpoint, DISCOVERY_QUEUE_CAPACITY, Concurrent::SPSC> endpoints;
+    EventFd ready; // signalled once per batch of endpoints handed over
     ~DiscoveryService()
     {
         stop();
@@ -45,17 +86,210 @@ struct DiscoveryService
     void stop();
 };
 
+string build_discovery_hello(const MacAddress &mac, string_view hostname);
+std::vector<IpEndpoint> discovery_targets(int port);
+bool parse_discovery_hello(string_view packet, MachineEndpoint &machine);
+
 #endif // DISCOVERY_SERVICE_H_
 #ifdef DISCOVERY_SERVICE_IMPLEMENTATION
 
+// Lays out a participant hello: header, hostname length, hostname, mac address bytes and mac address string
+string build_discovery_hello(const MacAddress &mac, string_view hostname)
+{
+    string packet;
+    int hostname_len = hostname.length();
+    packet.append(client_msg);
+    packet.append((char *)&(hostname_len), sizeof(hostname_len));
+    packet.append(hostname);
+    packet.append((char *)mac.mac_addr, MAC_ADDR_MAX);
+    // The formatted address is only there for older managers, it is padded to the size they expect
+    InlineString<MAC_TEXT_MAX> mac_text = mac.str();
+    packet.append(mac_text.data(), mac_text.size());
+    packet.append(MAC_STR_MAX - mac_text.size(), '\0');
+    return packet;
+}
+
+// Directed broadcast address of every broadcast capable interface, the limited broadcast address when there is none
+std::vector<IpEndpoint> discovery_targets(int port)
+{
+    std::vector<IpEndpoint> targets;
+    for (const Net::BroadcastInterface &network_interface : Net::broadcast_interfaces())
+    {
+        targets.push_back(IpEndpoint(ntohl(network_interface.broadcast), port));
+    }
+    if (targets.empty())
+    {
+        targets.push_back(IpEndpoint::broadcast(port));
+    }
+    return targets;
+}
+
+// Parses a participant hello straight out of the receive buffer into the machine it describes, the address is left untouched
+bool parse_discovery_hello(string_view packet, MachineEndpoint &machine)
+{
+    if (packet.rfind(client_msg) != 0)
+    {
+        return false;
+    }
+    size_t cursor = client_msg.size();
+    int hostname_len;
+    if (packet.size() < cursor + sizeof(hostname_len))
+    {
+        return false;
+    }
+    memcpy(&hostname_len, packet.data() + cursor, sizeof(hostname_len));
+    cursor += sizeof(hostname_len);
+    if (hostname_len <= 0 || packet.size() < cursor + hostname_len + MAC_ADDR_MAX + MAC_STR_MAX)
+    {
+        return false;
+    }
+
+    string_view client_hostname = packet.substr(cursor, hostname_len);
+    cursor += hostname_len;
+
+    string_view client_mac_addr = packet.substr(cursor, MAC_ADDR_MAX);
+    cursor += MAC_ADDR_MAX;
+
+    // The formatted mac address that follows is redundant with the bytes
+    cursor += MAC_STR_MAX;
+
+    memcpy(machine.mac.mac_addr, client_mac_addr.data(), MAC_ADDR_MAX);
+    machine.hostname = client_hostname;
+    return true;
+}
+
+// Answers hellos for as long as the service runs, suspended whenever the socket has nothing to read
+static Async::Task discovery_serve(DiscoveryService *ds)
+{
+    Socket &server_socket = ds->udp_socket;
+    char buffers[DISCOVERY_BATCH][DISCOVERY_PACKET_MAX];
+    sockaddr addresses[DISCOVERY_BATCH];
+    iovec iovecs[DISCOVERY_BATCH];
+    mmsghdr messages[DISCOVERY_BATCH];
+    mmsghdr replies[DISCOVERY_BATCH];
+    iovec reply_iovec = {.iov_base = (void *)server_msg.data(), .iov_len = server_msg.size()};
+    for (int i = 0; i < DISCOVERY_BATCH; i++)
+    {
+        iovecs[i] = iovec{.iov_base = buffers[i], .iov_len = DISCOVERY_PACKET_MAX};
+    }
+
+    SeenSet<discovery_seen_t> seen(DISCOVERY_SEEN_CAPACITY);
+    while (ds->running)
+    {
+        for (int i = 0; i < DISCOVERY_BATCH; i++)
+        {
+            messages[i] = mmsghdr{};
+            messages[i].msg_hdr.msg_name = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        int received = co_await Async::recv_batch(server_socket, messages, DISCOVERY_BATCH, MSG_WAITFORONE);
+        if (received < 0)
+        {
+            perror("recvmmsg");
+            break;
+        }
+
+        Metrics::add(Metrics::DISCOVERY_PACKETS, received);
+        Metrics::record(Metrics::DISCOVERY_BATCH_SIZE, received);
+        unsigned int reply_count = 0;
+        bool handed_over = false;
+        int64_t now = monotonic_ms();
+        for (int i = 0; i < received; i++)
+        {
+            MachineEndpoint client_machine(addresses[i]);
+            string_view packet = string_view(buffers[i], messages[i].msg_len);
+            if (!parse_discovery_hello(packet, client_machine))
+            {
+                continue;
+            }
+            // Repeated hellos are only answered, a full queue leaves the client to retry
+            in_addr_t address = ((const sockaddr_in *)&addresses[i])->sin_addr.s_addr;
+            discovery_seen_t *known = seen.find(client_machine.mac.key(), now);
+            if (known != nullptr && known->address == address)
+            {
+                Metrics::add(Metrics::DISCOVERY_DUPLICATES);
+            }
+            else
+            {
+                if (!ds->endpoints.try_enqueue(client_machine))
+                {
+                    Metrics::add(Metrics::DISCOVERY_DROPPED);
+                    continue;
+                }
+                handed_over = true;
+                if (known != nullptr)
+                {
+                    Metrics::add(Metrics::DISCOVERY_ADDRESS_CHANGES);
+                }
+                known = &seen.insert(client_machine.mac.key(), discovery_seen_t{.address = address, .replied_ms = now - DISCOVERY_REPLY_INTERVAL_MS}, now, DISCOVERY_SEEN_TTL_MS);
+            }
+            if (now - known->replied_ms < DISCOVERY_REPLY_INTERVAL_MS)
+            {
+                Metrics::add(Metrics::DISCOVERY_REPLIES_SUPPRESSED);
+                continue;
+            }
+            known->replied_ms = now;
+
+            mmsghdr &reply = replies[reply_count++];
+            reply = mmsghdr{};
+            reply.msg_hdr.msg_name = &addresses[i];
+            reply.msg_hdr.msg_namelen = messages[i].msg_hdr.msg_namelen;
+            reply.msg_hdr.msg_iov = &reply_iovec;
+            reply.msg_hdr.msg_iovlen = 1;
+        }
+        Metrics::set(Metrics::DISCOVERY_QUEUE_DEPTH, ds->endpoints.size_approx());
+        if (handed_over)
+        {
+            ds->ready.notify();
+        }
+        if (reply_count > 0)
+        {
+            int sent = server_socket.send_batch(replies, reply_count, MSG_DONTWAIT);
+            if (sent < 0)
+            {
+                perror("sendmmsg");
+            }
+            else
+            {
+                Metrics::add(Metrics::DISCOVERY_REPLIES, sent);
+            }
+        }
+    }
+    ds->running = false;
+}
+
+// Lets clients that backed off while no manager was around know they can hurry up
+static Async::Task discovery_announce(DiscoveryService *ds)
+{
+    std::vector<IpEndpoint> announce_targets = discovery_targets(ds->port);
+    while (ds->running)
+    {
+        for (const IpEndpoint &target : announce_targets)
+        {
+            if (ds->udp_socket.send(announce_msg, target, MSG_DONTWAIT) < 0)
+            {
+                perror("announce");
+            }
+        }
+        co_await Async::sleep(DISCOVERY_ANNOUNCE_INTERVAL_MS);
+    }
+}
+
 void DiscoveryService::start_server()
 {
     if (running)
     {
         return;
     }
+    if (ready.file_descriptor == -1 && ready.open() < 0)
+    {
+        perror("discovery eventfd");
+    }
 
     running = true;
+    joinable = true;
     pthread_create(&thread, NULL, [](void *data) -> void *
                    {
         DiscoveryService *ds = (DiscoveryService *)data;
@@ -67,50 +301,18 @@ void DiscoveryService::start_server()
         if (result < 0)
         {
             perror("discovery start_server");
+            ds->running = false;
             return NULL;
         }
-        string buffer;
-        while (ds->running)
-        {
-            MachineEndpoint client_machine;
-            if (server_socket.recv(&buffer, client_machine, MSG_DONTWAIT) < 0)
-            {
-                if (errno == EAGAIN)
-                {
-                    continue;
-                }
-                perror("recv");
-                break;
-            }
-            string_view buffer_view = string_view(buffer);
-            if (buffer_view.rfind(client_msg) == 0)
-            {
-                MachineEndpoint top{};
-                if (ds->endpoints.peek(top) && top == client_machine)
-                {
-                    continue;
-                }
-                int cursor = client_msg.size();
-                int client_hostname_len = *(int *)buffer_view.substr(cursor, sizeof(int)).data();
-                cursor += sizeof(int);
-    
-                string_view client_hostname = buffer_view.substr(cursor, client_hostname_len);
-                cursor += client_hostname_len;
-    
-                string_view client_mac_addr = buffer_view.substr(cursor, MAC_ADDR_MAX);
-                cursor += MAC_ADDR_MAX;
-    
-                string_view client_mac_str = buffer_view.substr(cursor, MAC_STR_MAX);
-                cursor += MAC_STR_MAX;
-    
-                memcpy(client_machine.mac.mac_addr, client_mac_addr.data(), MAC_ADDR_MAX);
-                memcpy(client_machine.mac.mac_str, client_mac_str.data(), MAC_STR_MAX);
-                client_machine.hostname = client_hostname;
-    
-                ds->endpoints.enqueue(client_machine);
-                server_socket.send(server_msg, client_machine, MSG_DONTWAIT);
-            }
-        }
+
+        // Both coroutines share the thread, the idle timeout only lets the scheduler notice stop()
+        Async::Scheduler scheduler;
+        discovery_serve(ds);
+        discovery_announce(ds);
+        scheduler.run_while([ds]
+                            { return ds->running; }, DISCOVERY_IDLE_TIMEOUT_MS);
+        // Closed while the scheduler is still around, so the server coroutine is dropped along with its watch
+        Async::close(server_socket);
         ds->running = false;
         return NULL; }, this);
 }
@@ -121,60 +323,122 @@ void DiscoveryService::start_client()
     {
         return;
     }
+    if (ready.file_descriptor == -1 && ready.open() < 0)
+    {
+        perror("discovery eventfd");
+    }
 
     running = true;
+    joinable = true;
     pthread_create(&thread, NULL, [](void *data) -> void *
                    {
-        string client_message;
-        MacAddress mac = MacAddress::get_mac();
+        DiscoveryService *ds = std::move((DiscoveryService *)data);
         string hostname = get_hostname();
-        int hostname_len = hostname.length();
+        Backoff backoff(DISCOVERY_BACKOFF_BASE_MS, DISCOVERY_BACKOFF_CAP_MS, MacAddress::get_mac().key() ^ monotonic_ns());
 
-        client_message.append(client_msg);
+        // Hears manager announcements, the hellos go out through one socket per interface
+        Socket &listener = ds->udp_socket;
+        int result = listener.open(AddressFamily::InterNetwork, SocketType::Datagram, SocketProtocol::UDP);
+        // Only broadcasts arrive on this port, so it is shared with a manager on the same host
+        result |= listener.set_option(SO_REUSEADDR, 1);
+        result |= listener.bind(InternetAddress::Any, ds->port);
+        if (result < 0)
+        {
+            // Another process owns the port, the client still finds the manager, only more slowly
+            perrorcode("discovery listener");
+        }
 
-        client_message.append((char *)&(hostname_len), sizeof(hostname_len));
-        client_message.append(hostname);
-        
-        client_message.append((char *)mac.mac_addr, MAC_ADDR_MAX);
-        client_message.append(mac.mac_str, MAC_STR_MAX);
-        
-        DiscoveryService *ds = std::move((DiscoveryService *)data);
-        Socket &client_socket = ds->udp_socket;
-        IpEndpoint braodcast_ep = IpEndpoint::broadcast(ds->port);
-        
-        int result = client_socket.open(AddressFamily::InterNetwork, SocketType::Datagram, SocketProtocol::UDP);
-        result |= client_socket.bind(InternetAddress::Any, ds->port);
-        result |= client_socket.set_option(SO_BROADCAST, 1);
+        // Sized once, the sockets are never moved
+        const std::vector<Net::BroadcastInterface> &interfaces = Net::broadcast_interfaces();
+        std::vector<discovery_link_t> links(std::max<size_t>(interfaces.size(), 1));
+        for (size_t i = 0; i < links.size(); i++)
+        {
+            discovery_link_t &link = links[i];
+            link.socket.open(AddressFamily::InterNetwork, SocketType::Datagram, SocketProtocol::UDP);
+            link.socket.set_option(SO_BROADCAST, 1);
+            if (interfaces.empty())
+            {
+                link.target = IpEndpoint::broadcast(ds->port);
+                link.packet = build_discovery_hello(MacAddress::get_mac(), hostname);
+                continue;
+            }
+            // Bound to the interface address so the reply comes back to the card that asked
+            if (link.socket.bind(Address(ntohl(interfaces[i].address)), 0) < 0)
+            {
+                perrorcode("discovery bind");
+            }
+            link.target = IpEndpoint(ntohl(interfaces[i].broadcast), ds->port);
+            // Built once, replies are read into their own buffer
+            link.packet = build_discovery_hello(MacAddress::get_mac(interfaces[i].name), hostname);
+        }
+
+        std::vector<pollfd> readable(links.size() + 1);
+        for (size_t i = 0; i < links.size(); i++)
+        {
+            readable[i] = pollfd{.fd = links[i].socket.file_descriptor, .events = POLLIN, .revents = 0};
+        }
+        readable[links.size()] = pollfd{.fd = listener.file_descriptor, .events = POLLIN, .revents = 0};
 
+        int64_t next_hello = monotonic_ms();
         while (ds->running)
         {
-            if (client_socket.send(client_message, braodcast_ep) < 0)
+            int64_t now = monotonic_ms();
+            if (now >= next_hello)
             {
-                perror("send");
-                continue;
+                for (discovery_link_t &link : links)
+                {
+                    if (link.socket.send(link.packet, link.target) < 0)
+                    {
+                        perror("send");
+                    }
+                }
+                next_hello = now + backoff.next_delay();
             }
-            msleep(100);
-            MachineEndpoint server_endpoint;
-            string recv_buffer;
-            int read = client_socket.recv(&client_message, server_endpoint, MSG_DONTWAIT);
-            if (read < 0)
+
+            int ready = ::poll(readable.data(), readable.size(), (int)std::max<int64_t>(next_hello - monotonic_ms(), 0));
+            if (ready <= 0)
             {
+                if (ready < 0 && errno != EINTR)
+                {
+                    perror("poll");
+                }
                 continue;
             }
-            string_view msg = string_view(client_message.data(), read).substr(0, read);
-            if (msg == server_msg)
+            for (size_t i = 0; i < readable.size(); i++)
             {
-                MachineEndpoint top{INADDR_ANY, ds->port};
-                if (!ds->endpoints.peek(top))
+                if (!(readable[i].revents & POLLIN))
+                {
+                    continue;
+                }
+                Socket &socket = i < links.size() ? links[i].socket : listener;
+                IpEndpoint sender;
+                char reply[DISCOVERY_PACKET_MAX];
+                int read = socket.recv(reply, sizeof(reply), sender, MSG_DONTWAIT);
+                if (read < 0)
                 {
-                    ds->endpoints.enqueue(server_endpoint);
+                    continue;
+                }
+                string_view msg = string_view(reply, read);
+                if (msg == server_msg)
+                {
+                    ds->endpoints.try_enqueue(MachineEndpoint(sender.socket_address));
+                    ds->ready.notify();
+                    // Closed so discovery can start over if the manager is lost later
+                    listener.close();
+                    return NULL;
+                }
+                else if (msg == announce_msg)
+                {
+                    // Still jittered, a whole fleet hears the same announcement
+                    backoff.reset();
+                    next_hello = std::min(next_hello, monotonic_ms() + backoff.next_delay());
+                }
+                else if (msg.rfind("wakeup") == 0) {
+                    std::cout << "Grab a brush and put a little makeup" << std::endl;
                 }
-                return NULL;
-            }
-            else if (msg.rfind("wakeup") == 0) {
-                std::cout << "Grab a brush and put a little makeup" << std::endl;
             }
         }
+        listener.close();
         ds->running = false;
         return NULL; }, this);
 }
@@ -182,7 +446,11 @@ void DiscoveryService::start_client()
 void DiscoveryService::stop()
 {
     running = false;
-    pthread_join(thread, NULL);
+    if (joinable)
+    {
+        pthread_join(thread, NULL);
+        joinable = false;
+    }
 }
 
 #endif // DISCOVERY_SERVICE_IMPLEMENTATION
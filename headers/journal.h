@@ -0,0 +1,302 @@
+/*
+  Write ahead journal and snapshot of the participant table membership
+  Every join, identity change and removal is appended to the journal as a small binary record closed by a checksum
+  Once the journal grows past JOURNAL_COMPACT_BYTES the whole membership is written to a new snapshot and the journal starts over
+  On startup the snapshot is memory mapped and the journal tail replayed on top of it, a torn record at the end of the journal is cut off
+  Only membership is persisted, liveness is not, so every restored participant starts out sleeping until it checks in again
+*/
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include "macros.h"
+#include "management.hpp"
+
+#define JOURNAL_DIRECTORY "."
+#define JOURNAL_FILE "sleep_server.journal"
+#define JOURNAL_SNAPSHOT_FILE "sleep_server.snapshot"
+#define JOURNAL_HOSTNAME_MAX 255
+#define JOURNAL_COMPACT_BYTES (1 << 20)
+
+enum JournalRecordKind : uint8_t
+{
+    JOURNAL_UPSERT = 1, // the participant joined or its address or mac address changed
+    JOURNAL_REMOVE = 2, // the participant left the service
+};
+
+// On disk record header, followed by the hostname and a 32 bit checksum of everything before it
+typedef struct __attribute__((packed)) journal_record_t
+{
+    uint16_t length; // whole record including hostname and checksum
+    uint8_t kind;
+    uint8_t hostname_length;
+    uint32_t address; // network order
+    uint8_t mac[MAC_ADDR_MAX];
+    int64_t timestamp;
+} journal_record_t;
+
+struct Journal
+{
+    string directory;
+    int file_descriptor = -1;
+    size_t journal_bytes = 0;
+    string pending; // records appended since the last flush
+
+    ~Journal();
+
+    int open(const string &directory);
+    void append(JournalRecordKind kind, const MachineEndpoint &machine, time_t timestamp);
+    int flush();
+    bool should_compact() const;
+
+    // Replays the snapshot and then the journal, on_record(kind, machine, timestamp) sees every valid record in order
+    template <typename F>
+    int replay(F &&on_record);
+
+    // Writes a new snapshot through a temporary file and empties the journal
+    // write_entries receives a callback taking (machine, timestamp) and calls it once per participant
+    template <typename F>
+    int compact(F &&write_entries);
+
+    static size_t encode(string &out, JournalRecordKind kind, const MachineEndpoint &machine, time_t timestamp);
+    template <typename F>
+    static size_t decode(const unsigned char *data, size_t size, F &&on_record);
+
+private:
+    string path(const char *file) const;
+    int sync_directory() const;
+};
+
+// FNV-1a, enough to tell a torn or garbled record from a good one
+static inline uint32_t journal_checksum(const unsigned char *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns how many leading bytes held valid records
+template <typename F>
+size_t Journal::decode(const unsigned char *data, size_t size, F &&on_record)
+{
+    size_t cursor = 0;
+    while (size - cursor >= sizeof(journal_record_t) + sizeof(uint32_t))
+    {
+        journal_record_t record;
+        memcpy(&record, data + cursor, sizeof(record));
+        if (record.length != sizeof(record) + record.hostname_length + sizeof(uint32_t) || record.length > size - cursor ||
+            (record.kind != JOURNAL_UPSERT && record.kind != JOURNAL_REMOVE) || record.hostname_length == 0)
+        {
+            break;
+        }
+        uint32_t checksum;
+        memcpy(&checksum, data + cursor + record.length - sizeof(checksum), sizeof(checksum));
+        if (checksum != journal_checksum(data + cursor, record.length - sizeof(checksum)))
+        {
+            break;
+        }
+        MachineEndpoint machine(ntohl(record.address), 0);
+        machine.mac = MacAddress::from_bytes(record.mac);
+        machine.hostname.assign(string_view((const char *)data + cursor + sizeof(record), record.hostname_length));
+        on_record((JournalRecordKind)record.kind, machine, (time_t)record.timestamp);
+        cursor += record.length;
+    }
+    return cursor;
+}
+
+template <typename F>
+int Journal::replay(F &&on_record)
+{
+    int snapshot_fd = ::open(path(JOURNAL_SNAPSHOT_FILE).c_str(), O_RDONLY | O_CLOEXEC);
+    if (snapshot_fd >= 0)
+    {
+        struct stat info;
+        if (fstat(snapshot_fd, &info) == 0 && info.st_size > 0)
+        {
+            void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, snapshot_fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                decode((const unsigned char *)mapped, info.st_size, on_record);
+                munmap(mapped, info.st_size);
+            }
+        }
+        ::close(snapshot_fd);
+    }
+
+    struct stat info;
+    if (fstat(file_descriptor, &info) < 0)
+    {
+        return -1;
+    }
+    size_t valid = 0;
+    if (info.st_size > 0)
+    {
+        void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+        if (mapped == MAP_FAILED)
+        {
+            return -1;
+        }
+        valid = decode((const unsigned char *)mapped, info.st_size, on_record);
+        munmap(mapped, info.st_size);
+    }
+    // A crash in the middle of an append leaves a torn record, later appends must not land behind it
+    if (valid != (size_t)info.st_size && ftruncate(file_descriptor, valid) < 0)
+    {
+        return -1;
+    }
+    journal_bytes = valid;
+    return 0;
+}
+
+template <typename F>
+int Journal::compact(F &&write_entries)
+{
+    if (flush() < 0)
+    {
+        return -1;
+    }
+    string snapshot;
+    write_entries([&](const MachineEndpoint &machine, time_t timestamp)
+                  { encode(snapshot, JOURNAL_UPSERT, machine, timestamp); });
+
+    string temporary = path(JOURNAL_SNAPSHOT_FILE ".tmp");
+    int snapshot_fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (snapshot_fd < 0)
+    {
+        return -1;
+    }
+    size_t written = 0;
+    while (written < snapshot.size())
+    {
+        ssize_t result = ::write(snapshot_fd, snapshot.data() + written, snapshot.size() - written);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result < 0)
+        {
+            ::close(snapshot_fd);
+            return -1;
+        }
+        written += result;
+    }
+    // The snapshot has to be on disk before the journal it replaces is dropped
+    if (fdatasync(snapshot_fd) < 0 || ::close(snapshot_fd) < 0 || rename(temporary.c_str(), path(JOURNAL_SNAPSHOT_FILE).c_str()) < 0)
+    {
+        return -1;
+    }
+    // So is the rename, otherwise a crash can bring back the old snapshot next to an empty journal
+    if (sync_directory() < 0)
+    {
+        return -1;
+    }
+    if (ftruncate(file_descriptor, 0) < 0)
+    {
+        return -1;
+    }
+    journal_bytes = 0;
+    return 0;
+}
+
+#endif // JOURNAL_H_
+#ifdef JOURNAL_IMPLEMENTATION
+
+size_t Journal::encode(string &out, JournalRecordKind kind, const MachineEndpoint &machine, time_t timestamp)
+{
+    size_t hostname_length = std::min<size_t>(machine.hostname.size(), JOURNAL_HOSTNAME_MAX);
+    journal_record_t record = {};
+    record.length = sizeof(record) + hostname_length + sizeof(uint32_t);
+    record.kind = kind;
+    record.hostname_length = hostname_length;
+    record.address = machine.address;
+    memcpy(record.mac, machine.mac.mac_addr, MAC_ADDR_MAX);
+    record.timestamp = timestamp;
+
+    size_t start = out.size();
+    out.append((const char *)&record, sizeof(record));
+    out.append(machine.hostname.data(), hostname_length);
+    uint32_t checksum = journal_checksum((const unsigned char *)out.data() + start, out.size() - start);
+    out.append((const char *)&checksum, sizeof(checksum));
+    return record.length;
+}
+
+Journal::~Journal()
+{
+    flush();
+    if (file_descriptor != -1)
+    {
+        ::close(file_descriptor);
+    }
+}
+
+string Journal::path(const char *file) const
+{
+    return directory + "/" + file;
+}
+
+int Journal::sync_directory() const
+{
+    int directory_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd < 0)
+    {
+        return -1;
+    }
+    int result = fsync(directory_fd);
+    ::close(directory_fd);
+    return result;
+}
+
+int Journal::open(const string &directory)
+{
+    this->directory = directory;
+    file_descriptor = ::open(path(JOURNAL_FILE).c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return file_descriptor;
+}
+
+// Records are only buffered here, flush hands them to the kernel
+void Journal::append(JournalRecordKind kind, const MachineEndpoint &machine, time_t timestamp)
+{
+    encode(pending, kind, machine, timestamp);
+}
+
+// One write per batch of changes, the page cache keeps them across a crash of the process
+int Journal::flush()
+{
+    size_t written = 0;
+    while (written < pending.size())
+    {
+        ssize_t result = ::write(file_descriptor, pending.data() + written, pending.size() - written);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result < 0)
+        {
+            pending.erase(0, written);
+            return -1;
+        }
+        written += result;
+    }
+    journal_bytes += written;
+    pending.clear();
+    return 0;
+}
+
+bool Journal::should_compact() const
+{
+    return journal_bytes + pending.size() >= JOURNAL_COMPACT_BYTES;
+}
+
+#endif // JOURNAL_IMPLEMENTATION
@@ -42,6 +42,29 @@ static inline int msleep(long msec)
   return res;
 }
 
+// Milliseconds from a clock that is not affected by wall clock changes
+static inline int64_t monotonic_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Microseconds from the same clock, fine enough to time a round trip on a local network
+static inline int64_t monotonic_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline int64_t monotonic_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 using string = std::string;
 using string_view = std::string_view;
 
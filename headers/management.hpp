@@ -1,7 +1,11 @@
 /*
     Managent Table of participants
     This service is used to manage the participants in the network
-    It uses a mutex to control access to the table and a boolean to let the UI know when to print the table
+    It uses a mutex to control access to the table and a boolean to let the UI know when to redraw the table
+    Other threads never touch the table directly, they publish status events that the table owner applies in batches
+    Readers use immutable versioned snapshots published through RCU, so reading never blocks the owner
+    Participants are stored by dense id in columns, the fields touched on every event next to each other and the identity apart
+    Removing a participant moves the last one into its id, so sweeps over a column never skip holes
 */
 
 #ifndef MANAGEMENT_H_
@@ -16,148 +20,304 @@
 #include <thread>
 #include <condition_variable>
 #include <optional>
+#include <algorithm>
+#include <type_traits>
+#include <limits.h>
 #include "Net/Socket.hpp"
+#include "EventFd.hpp"
 #include "string_helpers.hpp"
+#include "metrics.h"
+#include "DataStructures/RingQueue.h"
+#include "DataStructures/Rcu.h"
+#include "DataStructures/TimerWheel.h"
+#include "DataStructures/InlineString.h"
+#include "DataStructures/FlatIndex.h"
 
 #define MAXLINE 1024
 #define INITIAL_PORT 35512
+#define TIME_BEFORE_SLEEP 5
+#define LIVENESS_RESOLUTION_MS 100
+#define STATUS_EVENT_BATCH 128
+#define STATUS_EVENT_CAPACITY 4096
+#define PARTICIPANT_AWAKE 0x1
 
 using string_view = std::string_view;
 using string = std::string;
 
 string client_msg = "General, Kenoby, you are a bold one";
 string server_msg = "Hello there!";
+string announce_msg = "Is anybody out there?";
 
 #define MAC_ADDR_MAX 6
-#define MAC_STR_MAX 64
-#define MAC_ADDRES_FILE "/sys/class/net/eth0/address"
+#define MAC_STR_MAX 64  // room the discovery hello leaves for the formatted address
+#define MAC_TEXT_MAX 17 // xx:xx:xx:xx:xx:xx
+#define MACHINE_HOSTNAME_MAX HOST_NAME_MAX
+#define MAC_ADDRESS_DIRECTORY "/sys/class/net/"
+#define MAC_DEFAULT_INTERFACE "eth0"
 
 struct MacAddress
 {
     unsigned char mac_addr[MAC_ADDR_MAX];
-    char mac_str[MAC_STR_MAX];
 
     bool operator==(const MacAddress &other) const
     {
         return memcmp(mac_addr, other.mac_addr, MAC_ADDR_MAX) == 0;
     }
 
-    static MacAddress get_mac()
+    // The six bytes packed into an integer, for hashing and lookups
+    uint64_t key() const
     {
-        MacAddress mac = {};
+        uint64_t key = 0;
+        memcpy(&key, mac_addr, MAC_ADDR_MAX);
+        return key;
+    }
+
+    // Formatted when shown, the six bytes are all that is kept
+    InlineString<MAC_TEXT_MAX> str() const
+    {
+        char text[MAC_TEXT_MAX + 1];
+        snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+        return InlineString<MAC_TEXT_MAX>(text);
+    }
 
-        FILE *f = fopen(MAC_ADDRES_FILE, "r");
+    // Reads the mac address of a network interface, false when the interface has none
+    static bool read_mac(const string &interface, MacAddress &mac)
+    {
+        string path = MAC_ADDRESS_DIRECTORY + interface + "/address";
+        FILE *f = fopen(path.c_str(), "r");
         if (f == NULL)
         {
-            perror("get_mac");
-            exit(EXIT_FAILURE);
+            return false;
         }
-
-        char mac_str[MAC_STR_MAX];
-        fscanf(f, "%s", mac_str);
+        unsigned char bytes[MAC_ADDR_MAX] = {};
+        int parsed = fscanf(f, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]);
         fclose(f);
+        mac = from_bytes(bytes);
+        return parsed == MAC_ADDR_MAX && !(mac == MacAddress{});
+    }
 
-        sscanf(mac_str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac.mac_addr[0],
-               &mac.mac_addr[1], &mac.mac_addr[2], &mac.mac_addr[3], &mac.mac_addr[4],
-               &mac.mac_addr[5]);
+    // Identity of this machine, the mac address of the first interface that can broadcast
+    static MacAddress get_mac()
+    {
+        static const MacAddress identity = []()
+        {
+            MacAddress mac = {};
+            for (const Net::BroadcastInterface &network_interface : Net::broadcast_interfaces())
+            {
+                if (read_mac(network_interface.name, mac))
+                {
+                    return mac;
+                }
+            }
+            if (!read_mac(MAC_DEFAULT_INTERFACE, mac))
+            {
+                fprintf(stderr, "get_mac: no interface with a mac address\n");
+                exit(EXIT_FAILURE);
+            }
+            return mac;
+        }();
+        return identity;
+    }
 
-        mac.mac_str[0] = '\0';
-        for (int i = 0; i < MAC_ADDR_MAX; i++)
+    // The mac address of one interface, the identity when that interface has none
+    static MacAddress get_mac(const string &interface)
+    {
+        MacAddress mac;
+        return read_mac(interface, mac) ? mac : get_mac();
+    }
+
+    // The mac address of the interface a connected socket goes out of, that is the card the other side can wake
+    static MacAddress for_socket(int file_descriptor)
+    {
+        sockaddr_in local = {};
+        socklen_t length = sizeof(local);
+        if (getsockname(file_descriptor, (sockaddr *)&local, &length) == 0)
         {
-            snprintf(mac.mac_str + strlen(mac.mac_str),
-                     MAC_STR_MAX - strlen(mac.mac_str), "%02x%s", mac.mac_addr[i],
-                     i < MAC_ADDR_MAX - 1 ? ":" : "");
+            for (const Net::BroadcastInterface &network_interface : Net::broadcast_interfaces())
+            {
+                if (network_interface.address == local.sin_addr.s_addr)
+                {
+                    return get_mac(network_interface.name);
+                }
+            }
         }
+        return get_mac();
+    }
+
+    static MacAddress from_bytes(const unsigned char bytes[MAC_ADDR_MAX])
+    {
+        MacAddress mac = {};
+        memcpy(mac.mac_addr, bytes, MAC_ADDR_MAX);
         return mac;
     }
 };
 
-struct MachineEndpoint : IpEndpoint
+// A participant as the services pass it around, fixed size and trivially copyable so the queues move it with a memcpy
+// Only ipv4 is spoken here, the address is kept in network order and the port in host order
+struct MachineEndpoint
 {
-    MacAddress mac;
-    string hostname;
-
-    MachineEndpoint() : IpEndpoint() {}
-    MachineEndpoint(in_addr_t address, int port) : IpEndpoint(address, port) {}
-    MachineEndpoint(sockaddr socket_address) : IpEndpoint(socket_address) {}
-
-    MachineEndpoint with_port(int port) const
+    in_addr_t address = 0;
+    uint16_t port = 0;
+    MacAddress mac = {};
+    InlineString<MACHINE_HOSTNAME_MAX> hostname;
+
+    MachineEndpoint() = default;
+    MachineEndpoint(in_addr_t address, int port) : address(htonl(address)), port(port) {}
+    MachineEndpoint(const sockaddr &socket_address)
     {
-        MachineEndpoint ep = *this;
-        struct sockaddr_in *ipv4_socket_address = (sockaddr_in *)&ep.socket_address;
-        ipv4_socket_address->sin_port = htons(port);
-        return ep;
+        const sockaddr_in *ipv4_socket_address = (const sockaddr_in *)&socket_address;
+        address = ipv4_socket_address->sin_addr.s_addr;
+        port = ntohs(ipv4_socket_address->sin_port);
     }
 
-    MachineEndpoint with_address(uint32_t address) const
+    MachineEndpoint with_port(int port) const
     {
         MachineEndpoint ep = *this;
-        struct sockaddr_in *ipv4_socket_address = (sockaddr_in *)&ep.socket_address;
-        ipv4_socket_address->sin_addr.s_addr = htonl(address);
+        ep.port = port;
         return ep;
     }
 
-    int get_port() const
+    // The socket level endpoint, for connecting and sending
+    IpEndpoint endpoint() const
     {
-        return ntohs(((struct sockaddr_in *)&socket_address)->sin_port);
+        return IpEndpoint(ntohl(address), port);
     }
 
     string to_string() const
     {
-        auto ip = inet_ntoa(((struct sockaddr_in *)&socket_address)->sin_addr);
-        auto port = ntohs(((struct sockaddr_in *)&socket_address)->sin_port);
-        return hostname + " " + mac.mac_str + " " + string(ip) + ":" + std::to_string(port);
-    }
-
-    static MachineEndpoint MyMachine(Address address, int port)
-    {
-        MachineEndpoint ep;
-        sockaddr_in *ipv4_socket_address = (sockaddr_in *)&ep.socket_address;
-        bzero(ipv4_socket_address, sizeof(*ipv4_socket_address));
-
-        ep.address_length = sizeof(struct sockaddr_in);
-        ipv4_socket_address->sin_family = AddressFamily::InterNetwork;
-        ipv4_socket_address->sin_addr.s_addr = address.network_order();
-        ipv4_socket_address->sin_port = htons(port);
-        ep.mac = MacAddress::get_mac();
-        ep.hostname = get_hostname();
-        return ep;
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address, ip, sizeof(ip));
+        return hostname.str() + " " + mac.str().c_str() + " " + ip + ":" + std::to_string(port);
     }
 };
 
+static_assert(std::is_trivially_copyable_v<MachineEndpoint>, "endpoints are copied through lock free queues");
+
 // Represents a participant using the service
 typedef struct participant_t
 {
     MachineEndpoint machine;
-    bool status; // true means awake, false means asleep
-    std::shared_ptr<Socket> socket;
+    bool status;      // true means awake, false means asleep
+    uint64_t session; // monitoring connection currently bound to the participant, 0 when there is none
     time_t last_conection_timestamp;
+    uint32_t timer; // liveness deadline in the table timer wheel
 } participant_t;
 
+enum StatusEventKind
+{
+    STATUS_JOINED, // a participant said hello on a monitoring session
+    STATUS_SEEN,   // traffic arrived on the session
+    STATUS_ASLEEP, // the session hung up
+    STATUS_LEFT,   // the participant asked to leave the service
+};
+
+// A change observed by a service thread, applied to the table by its owner
+typedef struct status_event_t
+{
+    StatusEventKind kind;
+    uint64_t session;
+    time_t timestamp;
+    MachineEndpoint machine; // only the hostname is meaningful unless the participant joined
+    uint32_t deadline_ms;    // how long until the participant counts as sleeping without another event, 0 for TIME_BEFORE_SLEEP
+} status_event_t;
+
+struct Journal;
+
+// Immutable copy of the table sorted by hostname
+struct ParticipantSnapshot
+{
+    uint64_t version = 0;
+    std::vector<participant_t> participants;
+
+    const participant_t *find(const std::string &hostname) const;
+};
+
 // Represents the table of users using the service
 struct ParticipantTable
 {
-    std::unordered_map<string, participant_t, StringHashIgnoreCase, StringEqComparerIgnoreCase> map;
+    // Hot columns, indexed by participant id
+    std::vector<uint8_t> status; // PARTICIPANT_AWAKE
+    std::vector<time_t> last_seen;
+    std::vector<uint32_t> timer;   // liveness deadline in the table timer wheel
+    std::vector<uint64_t> session; // monitoring connection currently bound to the participant, 0 when there is none
+    // Cold column, only read when a participant joins, moves, is persisted or shown
+    std::vector<MachineEndpoint> machines;
+    FlatIndex index; // hostname, ignoring case -> id
     bool dirty;
+    uint64_t version;
     std::mutex sync_root;
+    int64_t locked_at_ns; // when the current holder took the lock, 0 when nobody holds it
+    Concurrent::RingQueue<status_event_t, STATUS_EVENT_CAPACITY, Concurrent::MPSC> events;
+    EventFd changed; // signalled when events were published, so the owner can sleep until there is work
+    Concurrent::RcuCell<ParticipantSnapshot> snapshots;
+    TimerWheel<uint32_t> timers; // participant id of each deadline
+    Journal *journal;            // membership changes are appended here when set
 
     ParticipantTable();
     ~ParticipantTable();
 
     void lock();
     void unlock();
-    void print();
+    size_t size() const;
+    size_t count_awake() const;
+    uint32_t find(string_view hostname) const;
+    participant_t get(uint32_t id) const;
     void add(const participant_t &participant);
-    void remove(const std::string &hostname);
-    void update_status(const std::string &hostname, bool status);
+    void remove(string_view hostname);
+    void set_status(uint32_t id, bool awake);
+    size_t expire(int64_t now_ms);
+    void rearm(uint32_t id, uint32_t deadline_ms = 0);
+
+    void publish(const status_event_t &event);
+    size_t apply_events();
+    void apply(const status_event_t &event);
+
+    template <typename Queue>
+    size_t admit(Queue &discovered);
 
-    participant_t &get(const std::string &hostname);
+    void publish_snapshot();
+    size_t restore(Journal &journal);
+    void persist();
+    Concurrent::RcuCell<ParticipantSnapshot>::ReadGuard snapshot();
+
+private:
+    void erase(uint32_t id);
 };
 
+// Adds every discovered machine waiting in the queue in one batch, requires the lock
+template <typename Queue>
+size_t ParticipantTable::admit(Queue &discovered)
+{
+    static thread_local MachineEndpoint batch[STATUS_EVENT_BATCH];
+    size_t admitted = 0;
+    size_t count;
+    while ((count = discovered.drain(batch, STATUS_EVENT_BATCH)) > 0)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            add(participant_t{
+                .machine = std::move(batch[i]),
+                .status = true,
+                .session = 0,
+                .last_conection_timestamp = time(NULL),
+                .timer = TIMER_NIL});
+        }
+        admitted += count;
+    }
+    return admitted;
+}
+
 #endif // MANAGEMENT_H_
 #ifdef MANAGEMENT_IMPLEMENTATION
 
-ParticipantTable::ParticipantTable() : map(), dirty(false), sync_root(){};
+ParticipantTable::ParticipantTable() : index(), dirty(false), version(0), sync_root(), locked_at_ns(0), timers(LIVENESS_RESOLUTION_MS, monotonic_ms()), journal(nullptr)
+{
+    if (changed.open() < 0)
+    {
+        perror("table eventfd");
+    }
+}
 ParticipantTable::~ParticipantTable()
 {
     unlock();
@@ -166,68 +326,334 @@ ParticipantTable::~ParticipantTable()
 void ParticipantTable::lock()
 {
     sync_root.lock();
+    locked_at_ns = monotonic_ns();
 }
 
 void ParticipantTable::unlock()
 {
+    if (locked_at_ns != 0)
+    {
+        Metrics::record(Metrics::TABLE_LOCK_HOLD_NS, monotonic_ns() - locked_at_ns);
+        locked_at_ns = 0;
+    }
     sync_root.unlock();
 }
 
-void ParticipantTable::print()
+const participant_t *ParticipantSnapshot::find(const std::string &hostname) const
+{
+    auto it = std::lower_bound(participants.begin(), participants.end(), hostname, [](const participant_t &participant, const std::string &key)
+                               { return strcasecmp(participant.machine.hostname.c_str(), key.c_str()) < 0; });
+    if (it == participants.end() || strcasecmp(it->machine.hostname.c_str(), hostname.c_str()) != 0)
+    {
+        return nullptr;
+    }
+    return &*it;
+}
+
+size_t ParticipantTable::size() const
+{
+    return machines.size();
+}
+
+// Straight pass over the status column, cheap enough for every snapshot
+size_t ParticipantTable::count_awake() const
 {
-    std::cout << "\t\t\t\033[1mManagement Table\033[0m\t\t\t\n";
-    std::cout << "\033[1mHost name\tMac address\t\tIp address\t\tstatus\t\tLast conection\033[0m\n";
-    for (auto [host_name, participant] : map)
+    size_t awake = 0;
+    const uint8_t *bits = status.data();
+    for (size_t id = 0; id < status.size(); id++)
     {
-        MachineEndpoint machine = participant.machine;
-        string status = participant.status ? "awake" : "sleeping";
-        struct tm *tm = localtime(&participant.last_conection_timestamp);
-        std::printf("%s\t%s\t%s\t\t%s\t\t%d/%d/%d %d:%d.%d\n",
-                    host_name.c_str(),
-                    machine.mac.mac_str,
-                    inet_ntoa(((sockaddr_in *)&machine.socket_address)->sin_addr),
-                    status.c_str(),
-                    tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+        awake += bits[id] & PARTICIPANT_AWAKE;
     }
-    std::cout << std::endl;
-    dirty = false;
+    return awake;
+}
+
+// The id of a participant, FLAT_INDEX_NIL when the table does not know the hostname
+uint32_t ParticipantTable::find(string_view hostname) const
+{
+    return index.find(ascii_hash_ignore_case(hostname), [&](uint32_t id)
+                      {
+        const InlineString<MACHINE_HOSTNAME_MAX> &known = machines[id].hostname;
+        return known.size() == hostname.size() && strncasecmp(known.data(), hostname.data(), hostname.size()) == 0; });
+}
+
+// Gathers the columns of one participant into a row
+participant_t ParticipantTable::get(uint32_t id) const
+{
+    return participant_t{
+        .machine = machines[id],
+        .status = (status[id] & PARTICIPANT_AWAKE) != 0,
+        .session = session[id],
+        .last_conection_timestamp = last_seen[id],
+        .timer = timer[id]};
 }
 
 void ParticipantTable::add(const participant_t &participant)
 {
-    auto [_, success] = map.emplace(participant.machine.hostname, participant);
-    if (success)
+    if (find(participant.machine.hostname) != FLAT_INDEX_NIL)
     {
-        dirty = true;
+        return;
+    }
+    uint32_t id = machines.size();
+    machines.push_back(participant.machine);
+    status.push_back(participant.status ? PARTICIPANT_AWAKE : 0);
+    last_seen.push_back(participant.last_conection_timestamp);
+    session.push_back(participant.session);
+    timer.push_back(timers.schedule(id, monotonic_ms() + TIME_BEFORE_SLEEP * 1000));
+    index.insert(ascii_hash_ignore_case(participant.machine.hostname), id);
+    dirty = true;
+    version++;
+    if (journal != nullptr)
+    {
+        journal->append(JOURNAL_UPSERT, participant.machine, participant.last_conection_timestamp);
     }
 }
 
-void ParticipantTable::remove(const std::string &hostname)
+// Moves the last participant into the freed id so the columns stay dense
+void ParticipantTable::erase(uint32_t id)
 {
-    if (map.erase(hostname))
+    uint32_t last = machines.size() - 1;
+    timers.cancel(timer[id]);
+    index.erase(ascii_hash_ignore_case(machines[id].hostname), id);
+    if (id != last)
     {
-        dirty = true;
+        index.relabel(ascii_hash_ignore_case(machines[last].hostname), last, id);
+        timers[timer[last]] = id;
+        machines[id] = machines[last];
+        status[id] = status[last];
+        last_seen[id] = last_seen[last];
+        session[id] = session[last];
+        timer[id] = timer[last];
     }
+    machines.pop_back();
+    status.pop_back();
+    last_seen.pop_back();
+    session.pop_back();
+    timer.pop_back();
 }
 
-void ParticipantTable::update_status(const std::string &hostname, bool status)
+void ParticipantTable::remove(string_view hostname)
 {
-    auto it = map.find(hostname);
-    if (it == map.end())
+    uint32_t id = find(hostname);
+    if (id == FLAT_INDEX_NIL)
     {
         return;
     }
-    auto &[host, participant] = *it;
-    if (participant.status != status)
+    if (journal != nullptr)
+    {
+        journal->append(JOURNAL_REMOVE, machines[id], time(NULL));
+    }
+    erase(id);
+    dirty = true;
+    version++;
+}
+
+void ParticipantTable::set_status(uint32_t id, bool awake)
+{
+    uint8_t bits = awake ? status[id] | PARTICIPANT_AWAKE : status[id] & ~PARTICIPANT_AWAKE;
+    if (status[id] != bits)
     {
-        participant.status = status;
+        status[id] = bits;
         dirty = true;
+        version++;
+    }
+}
+
+// Marks everyone not heard from in TIME_BEFORE_SLEEP seconds as sleeping, requires the lock
+// Only the deadlines that are due are visited
+size_t ParticipantTable::expire(int64_t now_ms)
+{
+    return timers.advance(now_ms, [this](uint32_t handle)
+                          { set_status(timers[handle], false); });
+}
+
+// Pushes the participant liveness deadline forward, requires the lock
+// The monitoring service passes a longer deadline for participants it probes less often
+void ParticipantTable::rearm(uint32_t id, uint32_t deadline_ms)
+{
+    int64_t deadline = deadline_ms != 0 ? deadline_ms : TIME_BEFORE_SLEEP * 1000;
+    timers.reschedule(timer[id], monotonic_ms() + deadline);
+}
+
+// Safe to call from any thread without the lock, waits for the owner when the queue is full
+void ParticipantTable::publish(const status_event_t &event)
+{
+    events.enqueue(event);
+    changed.notify();
+}
+
+// Drains the published events, called by the table owner without holding the lock
+// Events are dequeued outside the lock and applied in batches so the lock is only held for the table updates
+size_t ParticipantTable::apply_events()
+{
+    static thread_local status_event_t batch[STATUS_EVENT_BATCH];
+    size_t applied = 0;
+    changed.consume();
+    Metrics::set(Metrics::STATUS_EVENT_QUEUE_DEPTH, events.size_approx());
+    while (true)
+    {
+        size_t count = events.drain(batch, STATUS_EVENT_BATCH);
+        if (count == 0)
+        {
+            Metrics::add(Metrics::TABLE_EVENTS_APPLIED, applied);
+            return applied;
+        }
+        lock();
+        for (size_t i = 0; i < count; i++)
+        {
+            apply(batch[i]);
+        }
+        unlock();
+        applied += count;
+    }
+}
+
+// Applies a single event, requires the lock
+// Only the session currently bound to a participant may put it to sleep or remove it
+void ParticipantTable::apply(const status_event_t &event)
+{
+    uint32_t id = find(event.machine.hostname);
+    if (event.kind == STATUS_JOINED)
+    {
+        if (id == FLAT_INDEX_NIL)
+        {
+            add(participant_t{
+                .machine = event.machine,
+                .status = true,
+                .session = event.session,
+                .last_conection_timestamp = event.timestamp,
+                .timer = TIMER_NIL});
+            return;
+        }
+        MachineEndpoint &machine = machines[id];
+        // The hello is authoritative, a host that came back with another address or network card keeps its entry
+        if (!(machine.mac == event.machine.mac) || machine.address != event.machine.address)
+        {
+            machine = event.machine;
+            dirty = true;
+            if (journal != nullptr)
+            {
+                journal->append(JOURNAL_UPSERT, machine, event.timestamp);
+            }
+        }
+        session[id] = event.session;
+        last_seen[id] = event.timestamp;
+        version++;
+        rearm(id, event.deadline_ms);
+        set_status(id, true);
+        return;
+    }
+
+    if (id == FLAT_INDEX_NIL || session[id] != event.session)
+    {
+        return;
+    }
+    switch (event.kind)
+    {
+    case STATUS_SEEN:
+        last_seen[id] = event.timestamp;
+        version++;
+        rearm(id, event.deadline_ms);
+        set_status(id, true);
+        break;
+    case STATUS_ASLEEP:
+        session[id] = 0;
+        set_status(id, false);
+        break;
+    case STATUS_LEFT:
+        remove(event.machine.hostname);
+        break;
+    default:
+        break;
+    }
+}
+
+// Called by the table owner, copies the table into a new snapshot if it changed since the last one
+// Only the owner mutates the table so the copy does not need the lock
+void ParticipantTable::publish_snapshot()
+{
+    if (snapshot()->version == version)
+    {
+        return;
+    }
+    ParticipantSnapshot *next = new ParticipantSnapshot();
+    next->version = version;
+    next->participants.reserve(size());
+    for (uint32_t id = 0; id < size(); id++)
+    {
+        next->participants.push_back(get(id));
+    }
+    size_t awake = count_awake();
+    Metrics::set(Metrics::TABLE_PARTICIPANTS, size());
+    Metrics::set(Metrics::TABLE_AWAKE, awake);
+    Metrics::set(Metrics::TABLE_ASLEEP, size() - awake);
+    std::sort(next->participants.begin(), next->participants.end(), [](const participant_t &lhs, const participant_t &rhs)
+              { return strcasecmp(lhs.machine.hostname.c_str(), rhs.machine.hostname.c_str()) < 0; });
+    snapshots.publish(next);
+}
+
+// Loads the persisted membership, every restored participant starts out sleeping
+// Changes made afterwards are appended to the journal
+size_t ParticipantTable::restore(Journal &journal)
+{
+    this->journal = nullptr;
+    int result = journal.replay([this](JournalRecordKind kind, const MachineEndpoint &machine, time_t timestamp)
+                                {
+        if (kind == JOURNAL_REMOVE)
+        {
+            remove(machine.hostname);
+            return;
+        }
+        uint32_t id = find(machine.hostname);
+        if (id != FLAT_INDEX_NIL)
+        {
+            machines[id] = machine;
+            last_seen[id] = timestamp;
+            return;
+        }
+        add(participant_t{
+            .machine = machine,
+            .status = false,
+            .session = 0,
+            .last_conection_timestamp = timestamp,
+            .timer = TIMER_NIL}); });
+    if (result < 0)
+    {
+        perrorcode("journal replay");
+    }
+    this->journal = &journal;
+    return size();
+}
+
+// Hands the buffered journal records to the kernel, compacting into a new snapshot when the journal got large, owner only
+void ParticipantTable::persist()
+{
+    if (journal == nullptr)
+    {
+        return;
+    }
+    if (!journal->should_compact())
+    {
+        if (journal->flush() < 0)
+        {
+            perrorcode("journal flush");
+        }
+        return;
+    }
+    int result = journal->compact([this](auto &&write_entry)
+                                  {
+        for (uint32_t id = 0; id < size(); id++)
+        {
+            write_entry(machines[id], last_seen[id]);
+        } });
+    if (result < 0)
+    {
+        perrorcode("journal compact");
     }
 }
 
-participant_t &ParticipantTable::get(const std::string &hostname)
+Concurrent::RcuCell<ParticipantSnapshot>::ReadGuard ParticipantTable::snapshot()
 {
-    return map.at(hostname);
+    return snapshots.read();
 }
 
 #endif // MANAGEMENT_IMPLEMENTATION
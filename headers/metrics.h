@@ -0,0 +1,463 @@
+/*
+  Process wide metrics registry
+  Every thread records into its own shard, so counters and histograms are plain relaxed stores on memory no other thread writes
+  Shards are only summed when someone scrapes, gauges hold a single last written value
+  Histograms are log linear, each power of two is split in METRICS_SUB_BUCKETS linear buckets, so the relative error stays under 25% at any scale
+  The metrics service serves everything in the Prometheus text format over HTTP on the loopback interface
+*/
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "macros.h"
+#include "Net/Socket.hpp"
+
+#define METRICS_SUB_BITS 2
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+#define METRICS_REQUEST_MAX 1024
+
+namespace Metrics
+{
+  enum CounterId
+  {
+    DISCOVERY_PACKETS,
+    DISCOVERY_REPLIES,
+    DISCOVERY_DUPLICATES,
+    DISCOVERY_DROPPED,
+    DISCOVERY_ADDRESS_CHANGES,
+    DISCOVERY_REPLIES_SUPPRESSED,
+    MONITORING_ACCEPTS,
+    MONITORING_FRAMES,
+    MONITORING_PROBES_SENT,
+    MONITORING_PROBE_REPLIES,
+    MONITORING_HANGUPS,
+    MONITORING_PROBE_TIMEOUTS,
+    MONITORING_HEARTBEATS,
+    MONITORING_HEARTBEATS_LOST,
+    TABLE_EVENTS_APPLIED,
+    COMMANDS_EXECUTED,
+    COMMAND_ERRORS,
+    UI_FRAMES,
+    UI_BYTES,
+    MANAGER_WAKEUPS,
+    IO_SYSCALLS,
+    COUNTER_COUNT,
+  };
+
+  enum GaugeId
+  {
+    TABLE_PARTICIPANTS,
+    TABLE_AWAKE,
+    TABLE_ASLEEP,
+    DISCOVERY_QUEUE_DEPTH,
+    STATUS_EVENT_QUEUE_DEPTH,
+    MONITORING_SESSIONS,
+    HEARTBEAT_HOSTS,
+    IO_URING_WORKERS,
+    GAUGE_COUNT,
+  };
+
+  enum HistogramId
+  {
+    PROBE_RTT_US,
+    TABLE_LOCK_HOLD_NS,
+    DISCOVERY_BATCH_SIZE,
+    COMMAND_LATENCY_US,
+    HISTOGRAM_COUNT,
+  };
+
+  typedef struct metric_info_t
+  {
+    const char *name;
+    const char *help;
+  } metric_info_t;
+
+  extern const metric_info_t counter_info[COUNTER_COUNT];
+  extern const metric_info_t gauge_info[GAUGE_COUNT];
+  extern const metric_info_t histogram_info[HISTOGRAM_COUNT];
+
+  typedef struct histogram_t
+  {
+    std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> count;
+  } histogram_t;
+
+  // Written only by the thread that owns it, read by scrapes
+  typedef struct shard_t
+  {
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    histogram_t histograms[HISTOGRAM_COUNT];
+  } shard_t;
+
+  // Merged view of one histogram across every shard
+  typedef struct histogram_snapshot_t
+  {
+    uint64_t buckets[METRICS_BUCKETS];
+    uint64_t sum;
+    uint64_t count;
+
+    uint64_t percentile(double fraction) const;
+  } histogram_snapshot_t;
+
+  extern std::atomic<int64_t> gauges[GAUGE_COUNT];
+
+  shard_t *register_shard();
+  void retire_shard(shard_t *shard);
+
+  // Folds the shard of an exiting thread into the totals and frees it
+  struct shard_owner_t
+  {
+    shard_t *&local;
+    ~shard_owner_t()
+    {
+      retire_shard(local);
+      local = nullptr;
+    }
+  };
+
+  static inline shard_t &shard()
+  {
+    static thread_local shard_t *local = nullptr;
+    if (__builtin_expect(local == nullptr, 0))
+    {
+      local = register_shard();
+      // Constructed once per thread, the fast path above stays a plain pointer test
+      static thread_local shard_owner_t owner{local};
+    }
+    return *local;
+  }
+
+  // Only the owning thread writes, so a relaxed load and store is enough and avoids a locked instruction
+  static inline void bump(std::atomic<uint64_t> &cell, uint64_t amount)
+  {
+    cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+
+  static inline uint32_t bucket_index(uint64_t value)
+  {
+    if (value < METRICS_SUB_BUCKETS)
+    {
+      return (uint32_t)value;
+    }
+    uint32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t sub = (value >> (exponent - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1);
+    return (exponent - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS | sub;
+  }
+
+  // Largest value that falls in the bucket
+  static inline uint64_t bucket_upper_bound(uint32_t index)
+  {
+    if (index < METRICS_SUB_BUCKETS)
+    {
+      return index;
+    }
+    uint32_t exponent = (index >> METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+    uint64_t sub = index & (METRICS_SUB_BUCKETS - 1);
+    uint64_t lower = (1ULL << exponent) | (sub << (exponent - METRICS_SUB_BITS));
+    return lower + (1ULL << (exponent - METRICS_SUB_BITS)) - 1;
+  }
+
+  static inline void add(CounterId id, uint64_t amount = 1)
+  {
+    bump(shard().counters[id], amount);
+  }
+
+  static inline void set(GaugeId id, int64_t value)
+  {
+    gauges[id].store(value, std::memory_order_relaxed);
+  }
+
+  // For gauges several threads contribute to
+  static inline void adjust(GaugeId id, int64_t delta)
+  {
+    gauges[id].fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  static inline void record(HistogramId id, int64_t value)
+  {
+    uint64_t sample = value < 0 ? 0 : (uint64_t)value;
+    histogram_t &histogram = shard().histograms[id];
+    bump(histogram.buckets[bucket_index(sample)], 1);
+    bump(histogram.sum, sample);
+    bump(histogram.count, 1);
+  }
+
+  uint64_t counter(CounterId id);
+  histogram_snapshot_t histogram(HistogramId id);
+  std::string exposition();
+}
+
+struct MetricsService
+{
+  bool running = false;
+  int port = 0;
+  pthread_t thread;
+  bool joinable = false; // a thread was started and not joined yet
+  Socket tcp_socket;
+
+  ~MetricsService()
+  {
+    stop();
+  }
+  void start_server();
+  void stop();
+};
+
+#endif // METRICS_H_
+#ifdef METRICS_IMPLEMENTATION
+
+namespace Metrics
+{
+  // clang-format off
+  const metric_info_t counter_info[COUNTER_COUNT] = {
+    [DISCOVERY_PACKETS]        = {"sleep_discovery_packets_total", "Discovery datagrams received"},
+    [DISCOVERY_REPLIES]        = {"sleep_discovery_replies_total", "Discovery replies sent"},
+    [DISCOVERY_DUPLICATES]     = {"sleep_discovery_duplicates_total", "Discovery hellos from known hosts that were not queued again"},
+    [DISCOVERY_DROPPED]        = {"sleep_discovery_dropped_total", "Discovery hellos left unanswered because the queue was full"},
+    [DISCOVERY_ADDRESS_CHANGES] = {"sleep_discovery_address_changes_total", "Known hosts queued again because they came from another address"},
+    [DISCOVERY_REPLIES_SUPPRESSED] = {"sleep_discovery_replies_suppressed_total", "Discovery hellos not answered because the host was answered moments ago"},
+    [MONITORING_ACCEPTS]       = {"sleep_monitoring_accepts_total", "Monitoring connections accepted"},
+    [MONITORING_FRAMES]        = {"sleep_monitoring_frames_total", "Monitoring frames decoded"},
+    [MONITORING_PROBES_SENT]   = {"sleep_monitoring_probes_sent_total", "Probes queued to participants"},
+    [MONITORING_PROBE_REPLIES] = {"sleep_monitoring_probe_replies_total", "Probe replies received"},
+    [MONITORING_HANGUPS]       = {"sleep_monitoring_hangups_total", "Monitoring connections lost without an exit message"},
+    [MONITORING_PROBE_TIMEOUTS] = {"sleep_monitoring_probe_timeouts_total", "Sessions closed after too many unanswered probes"},
+    [MONITORING_HEARTBEATS]    = {"sleep_monitoring_heartbeats_total", "Heartbeat datagrams received"},
+    [MONITORING_HEARTBEATS_LOST] = {"sleep_monitoring_heartbeats_lost_total", "Heartbeats missing from the sequence numbers"},
+    [TABLE_EVENTS_APPLIED]     = {"sleep_table_events_applied_total", "Status events applied to the participant table"},
+    [COMMANDS_EXECUTED]        = {"sleep_commands_executed_total", "Console commands executed"},
+    [COMMAND_ERRORS]           = {"sleep_command_errors_total", "Console commands rejected"},
+    [UI_FRAMES]                = {"sleep_ui_frames_total", "Manager table frames drawn"},
+    [UI_BYTES]                 = {"sleep_ui_bytes_total", "Bytes written to the terminal by the table renderer"},
+    [MANAGER_WAKEUPS]          = {"sleep_manager_wakeups_total", "Times the manager main loop woke up"},
+    [IO_SYSCALLS]              = {"sleep_io_syscalls_total", "Syscalls made by the monitoring I/O engines"},
+  };
+
+  const metric_info_t gauge_info[GAUGE_COUNT] = {
+    [TABLE_PARTICIPANTS]       = {"sleep_table_participants", "Participants in the table"},
+    [TABLE_AWAKE]              = {"sleep_table_awake", "Participants marked awake"},
+    [TABLE_ASLEEP]             = {"sleep_table_asleep", "Participants marked sleeping"},
+    [DISCOVERY_QUEUE_DEPTH]    = {"sleep_discovery_queue_depth", "Discovered machines waiting for the table owner"},
+    [STATUS_EVENT_QUEUE_DEPTH] = {"sleep_status_event_queue_depth", "Status events waiting for the table owner"},
+    [MONITORING_SESSIONS]      = {"sleep_monitoring_sessions", "Open monitoring connections"},
+    [HEARTBEAT_HOSTS]          = {"sleep_heartbeat_hosts", "Participants tracked through heartbeats"},
+    [IO_URING_WORKERS]         = {"sleep_io_uring_workers", "Monitoring workers running on the io_uring engine"},
+  };
+
+  const metric_info_t histogram_info[HISTOGRAM_COUNT] = {
+    [PROBE_RTT_US]             = {"sleep_probe_rtt_microseconds", "Probe round trip time"},
+    [TABLE_LOCK_HOLD_NS]       = {"sleep_table_lock_hold_nanoseconds", "Time the participant table lock is held"},
+    [DISCOVERY_BATCH_SIZE]     = {"sleep_discovery_batch_size", "Datagrams received per discovery batch"},
+    [COMMAND_LATENCY_US]       = {"sleep_command_latency_microseconds", "Time spent executing a console command"},
+  };
+  // clang-format on
+
+  std::atomic<int64_t> gauges[GAUGE_COUNT];
+
+  static std::mutex shards_lock;
+  static shard_t retired; // what threads that already exited recorded
+  static std::vector<shard_t *> shards = {&retired};
+
+  shard_t *register_shard()
+  {
+    shard_t *created = new shard_t();
+    std::lock_guard<std::mutex> guard(shards_lock);
+    shards.push_back(created);
+    return created;
+  }
+
+  // Nothing recorded is lost, the values move into the retired shard before the memory is freed
+  void retire_shard(shard_t *shard)
+  {
+    std::lock_guard<std::mutex> guard(shards_lock);
+    for (int id = 0; id < COUNTER_COUNT; id++)
+    {
+      retired.counters[id].fetch_add(shard->counters[id].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    for (int id = 0; id < HISTOGRAM_COUNT; id++)
+    {
+      for (int i = 0; i < METRICS_BUCKETS; i++)
+      {
+        retired.histograms[id].buckets[i].fetch_add(shard->histograms[id].buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+      retired.histograms[id].sum.fetch_add(shard->histograms[id].sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      retired.histograms[id].count.fetch_add(shard->histograms[id].count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    shards.erase(std::find(shards.begin(), shards.end(), shard));
+    delete shard;
+  }
+
+  uint64_t counter(CounterId id)
+  {
+    std::lock_guard<std::mutex> guard(shards_lock);
+    uint64_t total = 0;
+    for (shard_t *shard : shards)
+    {
+      total += shard->counters[id].load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  histogram_snapshot_t histogram(HistogramId id)
+  {
+    histogram_snapshot_t merged = {};
+    std::lock_guard<std::mutex> guard(shards_lock);
+    for (shard_t *shard : shards)
+    {
+      const histogram_t &histogram = shard->histograms[id];
+      for (int i = 0; i < METRICS_BUCKETS; i++)
+      {
+        merged.buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+      }
+      merged.sum += histogram.sum.load(std::memory_order_relaxed);
+      merged.count += histogram.count.load(std::memory_order_relaxed);
+    }
+    return merged;
+  }
+
+  // Upper bound of the bucket holding the requested fraction of the samples
+  uint64_t histogram_snapshot_t::percentile(double fraction) const
+  {
+    uint64_t total = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++)
+    {
+      total += buckets[i];
+    }
+    if (total == 0)
+    {
+      return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * total);
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++)
+    {
+      seen += buckets[i];
+      if (seen > rank)
+      {
+        return bucket_upper_bound(i);
+      }
+    }
+    return bucket_upper_bound(METRICS_BUCKETS - 1);
+  }
+
+  static void append_header(std::string &out, const metric_info_t &info, const char *type)
+  {
+    out += "# HELP ";
+    out += info.name;
+    out += ' ';
+    out += info.help;
+    out += "\n# TYPE ";
+    out += info.name;
+    out += ' ';
+    out += type;
+    out += '\n';
+  }
+
+  std::string exposition()
+  {
+    std::string out;
+    char line[256];
+    for (int id = 0; id < COUNTER_COUNT; id++)
+    {
+      append_header(out, counter_info[id], "counter");
+      snprintf(line, sizeof(line), "%s %lu\n", counter_info[id].name, (unsigned long)counter((CounterId)id));
+      out += line;
+    }
+    for (int id = 0; id < GAUGE_COUNT; id++)
+    {
+      append_header(out, gauge_info[id], "gauge");
+      snprintf(line, sizeof(line), "%s %ld\n", gauge_info[id].name, (long)gauges[id].load(std::memory_order_relaxed));
+      out += line;
+    }
+    for (int id = 0; id < HISTOGRAM_COUNT; id++)
+    {
+      const char *name = histogram_info[id].name;
+      histogram_snapshot_t merged = histogram((HistogramId)id);
+      append_header(out, histogram_info[id], "histogram");
+      // Empty buckets are skipped, the cumulative counts stay correct without them
+      uint64_t cumulative = 0;
+      for (int i = 0; i < METRICS_BUCKETS; i++)
+      {
+        if (merged.buckets[i] == 0)
+        {
+          continue;
+        }
+        cumulative += merged.buckets[i];
+        snprintf(line, sizeof(line), "%s_bucket{le=\"%lu\"} %lu\n", name, (unsigned long)bucket_upper_bound(i), (unsigned long)cumulative);
+        out += line;
+      }
+      snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %lu\n%s_count %lu\n",
+               name, (unsigned long)cumulative, name, (unsigned long)merged.sum, name, (unsigned long)cumulative);
+      out += line;
+    }
+    return out;
+  }
+}
+
+// Answers every connection with the current exposition, one scrape at a time
+void MetricsService::start_server()
+{
+  if (running)
+  {
+    return;
+  }
+  running = true;
+  joinable = true;
+  pthread_create(&thread, NULL, [](void *data) -> void *
+                 {
+    MetricsService *ms = (MetricsService *)data;
+    Socket &listener = ms->tcp_socket;
+    int result = listener.open(SocketType::Stream, SocketProtocol::TCP);
+    result |= listener.set_option(SO_REUSEADDR, 1);
+    result |= listener.bind(InternetAddress::Loopback, ms->port);
+    result |= listener.listen(SOMAXCONN);
+    if (result < 0)
+    {
+      perrorcode("metrics start_server");
+      return NULL;
+    }
+
+    // Accept times out too, so the loop notices stop()
+    timeval request_timeout = {.tv_sec = 1, .tv_usec = 0};
+    listener.set_option(SO_RCVTIMEO, &request_timeout);
+    char request[METRICS_REQUEST_MAX];
+    while (ms->running)
+    {
+      IpEndpoint client_endpoint;
+      Socket client = listener.accept(client_endpoint);
+      if (client.file_descriptor == -1)
+      {
+        continue;
+      }
+      // The request itself is ignored, any path gets the metrics
+      client.set_option(SO_RCVTIMEO, &request_timeout);
+      client.recv(request, sizeof(request));
+      std::string body = Metrics::exposition();
+      std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                             std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+      client.send(response.data(), response.size(), MSG_NOSIGNAL);
+    }
+    ms->running = false;
+    return NULL; }, this);
+}
+
+void MetricsService::stop()
+{
+  running = false;
+  if (joinable)
+  {
+    pthread_join(thread, NULL);
+    joinable = false;
+  }
+}
+
+#endif // METRICS_IMPLEMENTATION
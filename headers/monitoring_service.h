@@ -1,8 +1,20 @@
 /*
   This service is used to monitor the network for new participants
-  It TCP to exchange messages with the all the participants in the network
-  Once a participant connects it its file descriptor is added to the polling list
+  It uses TCP to exchange framed binary messages (see wire_protocol.h) with all the participants in the network
+  The server runs a configurable number of workers, each with its own SO_REUSEPORT listener, I/O engine and shard of sessions
+  The kernel spreads incoming connections across the listeners, so workers never share a connection or a lock
+  Workers go through an IoEngine (see IoEngine.hpp), io_uring when the kernel has it and epoll otherwise, and handle accepts, bytes and hangups as events
+  Each session decodes frames out of its own fixed ring buffer, so the steady state does no heap allocation per message
+  Probes are scheduled per session on a timer wheel, a participant that keeps answering is probed less and less often
+  A participant that just joined, came back soon after leaving or missed a probe is probed at the fastest rate again
+  A connection that sends no hello within MONITORING_HELLO_TIMEOUT_MS is closed
+  After MONITORING_PROBE_MISSES unanswered probes the session is closed and the participant left sleeping until it reconnects
+  Participants can instead run in heartbeat mode, sending a small UDP frame every second to the single heartbeat socket of the manager
+  The manager then keeps about a hundred bytes per host, keyed by mac address, and no socket or file descriptor at all
+  A heartbeat host silent for MONITORING_HEARTBEAT_TIMEOUT_MS is marked sleeping and forgotten, so the hosts kept are only the live ones
+  A participant connects without blocking and retries with capped, jittered backoff, after a few dead attempts in a row it asks discovery for the manager again
   If a client doesnt respond for a while it is considered as sleeping if a client sends the exit command or exits via SIG_INT it gets removed from the table
+  The worker threads never take the table lock, every change is published as a status event for the table owner
 */
 #ifndef MONITORING_SERVICE_H_
 #define MONITORING_SERVICE_H_
@@ -24,18 +36,114 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include "macros.h"
+#include "IoEngine.hpp"
 #include "Net/Net.hpp"
 #include "management.hpp"
+#include "wire_protocol.h"
+#include "metrics.h"
+#include "backoff.h"
+
+#define MONITORING_MAX_EVENTS 64
+#define MONITORING_PROBE_RESOLUTION_MS 100
+#define MONITORING_PROBE_MIN_MS 500
+#define MONITORING_PROBE_MAX_MS 16000
+#define MONITORING_PROBE_TIMEOUT_MS 1000 // how long a probe waits for its reply before it counts as missed
+#define MONITORING_PROBE_MISSES 3
+#define MONITORING_PROBE_SETTLE 2         // replies in a row before the interval doubles
+#define MONITORING_PROBE_SETTLE_MAX 32
+#define MONITORING_PROBE_FLAP_WINDOW_MS 60000
+#define MONITORING_HELLO_TIMEOUT_MS 5000 // how long an accepted connection has to introduce itself
+// A client that hears nothing for this long assumes the manager gave up on it and reconnects
+#define MONITORING_CLIENT_SILENCE_MS (2 * MONITORING_PROBE_MAX_MS + MONITORING_PROBE_MISSES * MONITORING_PROBE_TIMEOUT_MS)
+#define MONITORING_CLIENT_TICK_MS 250
+#define MONITORING_CONNECT_TIMEOUT_MS 2000
+#define MONITORING_RECONNECT_BASE_MS 250
+#define MONITORING_RECONNECT_CAP_MS 10000
+#define MONITORING_REDISCOVER_AFTER 5 // failed attempts in a row before the manager is looked up again
+
+// Connection to the manager as seen by a participant
+enum MonitoringClientState
+{
+  CLIENT_IDLE,       // waiting out the backoff before the next attempt
+  CLIENT_CONNECTING, // non blocking connect in flight
+  CLIENT_CONNECTED,  // hello sent, answering probes
+};
+#define MONITORING_MAX_WORKERS 16
+#define MONITORING_HEARTBEAT_INTERVAL_MS 1000
+#define MONITORING_HEARTBEAT_TIMEOUT_MS (TIME_BEFORE_SLEEP * 1000) // silence after which a heartbeat host is asleep and forgotten
+#define MONITORING_TAG_LISTENER IO_TAG_MAX // engine tags, sessions use their id
+#define MONITORING_TAG_HEARTBEATS (IO_TAG_MAX - 1)
+
+// A connection accepted by the server, bound to a participant once it says hello
+typedef struct monitoring_session_t
+{
+  uint64_t id;
+  Socket socket;
+  IpEndpoint endpoint;
+  string host;
+  time_t last_published;
+  FrameDecoder decoder;
+  uint32_t probe_timer; // in the worker probe wheel, the hello deadline until the hello arrives
+  int64_t probe_interval_ms;
+  int settle;   // replies in a row needed before the interval grows
+  int answered; // replies in a row at the current interval
+  int missed;   // probes sent since the last reply
+  uint32_t published_deadline_ms;
+} monitoring_session_t;
+
+// When a participant last (re)joined and how long it has to stay up before its probes slow down
+typedef struct probe_churn_t
+{
+  int64_t changed_at_ms;
+  int settle;
+} probe_churn_t;
+
+// What the manager remembers about a participant in heartbeat mode
+typedef struct heartbeat_host_t
+{
+  uint64_t session;
+  uint32_t sequence;
+  uint32_t timer; // liveness deadline in the worker heartbeat wheel
+  in_addr_t address;
+  time_t last_published;
+  InlineString<MACHINE_HOSTNAME_MAX> hostname; // to name the host once it goes silent
+} heartbeat_host_t;
+
+struct MonitoringService;
+
+// One event loop of the server and the connections the kernel handed to its listener
+typedef struct monitoring_worker_t
+{
+  MonitoringService *service;
+  pthread_t thread;
+  Socket listener;
+} monitoring_worker_t;
 
 struct MonitoringService
 {
-  bool running;
-  int port;
+  bool running = false;
+  int port = 0;
+  int workers = 0;        // server event loops, 0 picks one per online cpu
+  bool heartbeat = false; // the client sends UDP heartbeats instead of holding a TCP connection
+  string io_engine;       // "epoll" keeps the server workers off io_uring
+  std::atomic<bool> lost{false}; // the client gave up on the manager endpoint, discovery has to run again
   pthread_t thread;
+  bool joinable = false; // the client thread was started and not joined yet
   IpEndpoint server_machine;
   ParticipantTable *participants;
   Socket tcp_socket;
+  Socket udp_socket; // heartbeats, owned by the first worker on the server
+  std::vector<monitoring_worker_t> shards;
+  unsigned char leave_frame[WIRE_MAX_FRAME]; // prebuilt so send_exit stays signal safe in heartbeat mode
+  size_t leave_frame_length = 0;
+  MacAddress heartbeat_mac; // of the interface the heartbeats leave from
+  std::atomic<uint64_t> next_session_id{1};
+  std::mutex churn_lock; // joins may land on any worker
+  std::unordered_map<uint64_t, probe_churn_t> churn;
 
   ~MonitoringService()
   {
@@ -43,6 +151,9 @@ struct MonitoringService
   }
   void start_server(ParticipantTable &participants);
   void start_client(const IpEndpoint &server_machine);
+  void start_heartbeat();
+  int probe_settle(const MacAddress &mac);
+  int send_exit();
   void stop();
 };
 
@@ -58,125 +169,364 @@ void MonitoringService::start_server(ParticipantTable &participants)
   }
   running = true;
   this->participants = std::addressof(participants);
-  pthread_create(&thread, NULL, [](void *data) -> void *
-                 {
-    StringEqComparerIgnoreCase string_equals;
-    MonitoringService *ms = (MonitoringService *)data;
-    timeval timeout = {
-        .tv_sec = 1,
-        .tv_usec = 0
+  int count = workers > 0 ? workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  count = std::clamp(count, 1, MONITORING_MAX_WORKERS);
+  int result = udp_socket.open(SocketType(SocketType::Datagram | SocketType::NonBlocking), SocketProtocol::UDP);
+  result |= udp_socket.set_option(SO_REUSEADDR, 1);
+  result |= udp_socket.bind(port);
+  if (result < 0)
+  {
+    perrorcode("heartbeat socket");
+    udp_socket.close();
+  }
+  // Sized once, the workers keep pointers to their own entry
+  shards = std::vector<monitoring_worker_t>(count);
+  for (monitoring_worker_t &shard : shards)
+  {
+    shard.service = this;
+    pthread_create(&shard.thread, NULL, [](void *data) -> void *
+                   {
+      monitoring_worker_t *worker = (monitoring_worker_t *)data;
+      MonitoringService *ms = worker->service;
+      Socket &listener = worker->listener;
+      std::unique_ptr<IoEngine> engine = IoEngine::create(ms->io_engine);
+      if (!engine) {
+        perrorcode("io engine");
+        return NULL;
+      }
+      if (strcmp(engine->name(), "io_uring") == 0) {
+        Metrics::adjust(Metrics::IO_URING_WORKERS, 1);
+      }
+      int result = listener.open(SocketType(SocketType::Stream | SocketType::NonBlocking), SocketProtocol::TCP);
+      result |= listener.set_option(SO_REUSEADDR, 1);
+      result |= listener.set_option(SO_REUSEPORT, 1);
+      result |= listener.bind(ms->port);
+      result |= listener.listen(SOMAXCONN);
+      result |= engine->listen(listener.file_descriptor, MONITORING_TAG_LISTENER);
+      // Heartbeats are cheap enough for one worker to take them all
+      bool heartbeats = worker == &ms->shards[0] && ms->udp_socket.file_descriptor != -1;
+      if (heartbeats) {
+        result |= engine->receive_datagrams(ms->udp_socket.file_descriptor, MONITORING_TAG_HEARTBEATS);
+      }
+      if(result < 0)
+      {
+        perrorcode("start_server");
+        return NULL;
+      }
+
+      std::unordered_map<uint64_t, monitoring_session_t> sessions;
+      io_event_t events[MONITORING_MAX_EVENTS];
+      TimerWheel<uint64_t> probes(MONITORING_PROBE_RESOLUTION_MS, monotonic_ms());
+
+      // The table waits a little longer than the worker would take to give up on the participant
+      auto liveness_deadline = [](const monitoring_session_t &session) -> uint32_t
+      {
+        return session.probe_interval_ms + (MONITORING_PROBE_MISSES + 1) * MONITORING_PROBE_TIMEOUT_MS;
       };
-    int result = ms->tcp_socket.open(SocketType::Stream, SocketProtocol::TCP);
-    result |= ms->tcp_socket.set_option(SO_REUSEADDR, 1);
-    result |= ms->tcp_socket.set_option(SO_RCVTIMEO, &timeout);
-    result |= ms->tcp_socket.set_option(SO_SNDTIMEO, &timeout);
-    result |= ms->tcp_socket.set_option(SO_REUSEADDR, 1);
-    result |= ms->tcp_socket.bind(ms->port); 
-    result |= ms->tcp_socket.listen();
-    if(result < 0)
-    {
-      perrorcode("start_server");
-      return NULL;
-    }
 
-    std::string packet;
-    std::vector<FileDescriptor*> to_poll = std::vector<FileDescriptor*>();
-    while(ms->running)
-    {   
-      ms->participants->lock();
-      
-      auto size = ms->participants->map.size();
-      if (size == 0) {
-        ms->participants->unlock();
-        continue;
-      }
-      
-      time_t unix_epoch_now = time(NULL);
-      time_t time_before_wake = 5;
-      for (auto &[host, participant] : ms->participants->map) {
-        if (participant.last_conection_timestamp + time_before_wake < unix_epoch_now) {
-          ms->participants->update_status(host, false);
+      auto publish = [&](StatusEventKind kind, monitoring_session_t &session)
+      {
+        status_event_t event = {};
+        event.kind = kind;
+        event.session = session.id;
+        event.timestamp = time(NULL);
+        event.machine.hostname = session.host;
+        if (kind == STATUS_SEEN) {
+          event.deadline_ms = session.published_deadline_ms = liveness_deadline(session);
         }
-        else {
-          ms->participants->update_status(host, true);
+        ms->participants->publish(event);
+      };
+
+      // Binds a connection to the participant named in its hello
+      auto adopt = [&](monitoring_session_t &session, const HelloMessage &hello)
+      {
+        session.host = string(hello.hostname);
+        session.last_published = time(NULL);
+        session.probe_interval_ms = MONITORING_PROBE_MIN_MS;
+        session.settle = ms->probe_settle(hello.mac);
+        session.answered = 0;
+        session.missed = 0;
+        // The hello deadline becomes the first probe
+        probes.reschedule(session.probe_timer, monotonic_ms() + MONITORING_PROBE_MIN_MS);
+        status_event_t event = {};
+        event.kind = STATUS_JOINED;
+        event.session = session.id;
+        event.timestamp = session.last_published;
+        event.machine = MachineEndpoint(session.endpoint.socket_address);
+        event.machine.mac = hello.mac;
+        event.machine.hostname = session.host;
+        event.deadline_ms = session.published_deadline_ms = liveness_deadline(session);
+        ms->participants->publish(event);
+      };
+
+      // A reply that follows a missed probe means the participant is unsteady, so it goes back to the fastest rate
+      auto on_reply = [&](monitoring_session_t &session)
+      {
+        if (session.missed > 1) {
+          session.probe_interval_ms = MONITORING_PROBE_MIN_MS;
+          session.answered = 0;
         }
-        if (participant.socket->file_descriptor == -1) {
-          IpEndpoint client_endpoint;
-          Socket client_socket = ms->tcp_socket.accept(client_endpoint);
-          if (client_socket.file_descriptor == -1) {
-            ms->participants->update_status(host, false);
-            continue;
-          }
-          result |= client_socket.file_descriptor;
-          *participant.socket = std::move(client_socket);
-          to_poll.push_back(participant.socket.get());
+        else if (++session.answered >= session.settle) {
+          session.probe_interval_ms = std::min<int64_t>(session.probe_interval_ms * 2, MONITORING_PROBE_MAX_MS);
+          session.answered = 0;
         }
-        result = participant.socket->send("probe from server");
-        string cmd(1024, '\0');
-        int imediate_test = participant.socket->recv(&cmd, MSG_DONTWAIT);
-        if (errno == 0 && imediate_test > 0) { 
-          participant.last_conection_timestamp = unix_epoch_now;
+        session.missed = 0;
+        probes.reschedule(session.probe_timer, monotonic_ms() + session.probe_interval_ms);
+      };
+
+      // A hangup leaves the participant sleeping, an exit message removes it from the table
+      auto close_session = [&](uint64_t id, bool left)
+      {
+        auto it = sessions.find(id);
+        if (it == sessions.end()) {
+          return;
         }
-      }
+        monitoring_session_t &session = it->second;
+        if (session.probe_timer != TIMER_NIL) {
+          probes.cancel(session.probe_timer);
+        }
+        engine->remove(id);
+        session.socket.close();
+        if (!session.host.empty()) {
+          publish(left ? STATUS_LEFT : STATUS_ASLEEP, session);
+        }
+        if (!left) {
+          Metrics::add(Metrics::MONITORING_HANGUPS);
+        }
+        sessions.erase(it);
+        Metrics::adjust(Metrics::MONITORING_SESSIONS, -1);
+      };
 
-      ms->participants->unlock();
-      msleep(300); // Let other threads get the GODDAMN MUTEX
-
-      std::vector<string> to_remove;
-
-      auto polls = FileDescriptor::poll(to_poll, POLLIN, 1000);
-      
-      ms->participants->sync_root.lock();
-      for (auto &poll : polls) {
-        int file_descriptor = poll.fd;
-        auto begin = ms->participants->map.begin();
-        auto end = ms->participants->map.end();
-        auto it = std::find_if(begin, end, [&file_descriptor](auto &p){ 
-          return p.second.socket->file_descriptor == file_descriptor;
-        });
-        if (it == end) {
-          continue;
+      std::unordered_map<uint64_t, heartbeat_host_t> heartbeat_hosts;
+      TimerWheel<uint64_t> heartbeat_expiry(MONITORING_PROBE_RESOLUTION_MS, monotonic_ms()); // mac key of each host
+
+      auto forget_host = [&](std::unordered_map<uint64_t, heartbeat_host_t>::iterator it)
+      {
+        heartbeat_expiry.cancel(it->second.timer);
+        heartbeat_hosts.erase(it);
+        Metrics::set(Metrics::HEARTBEAT_HOSTS, heartbeat_hosts.size());
+      };
+
+      auto on_heartbeat = [&](const HeartbeatMessage &heartbeat, uint8_t flags, const sockaddr_in &sender)
+      {
+        auto [it, created] = heartbeat_hosts.try_emplace(heartbeat.mac.key());
+        heartbeat_host_t &host = it->second;
+        bool restarted = false;
+        if (created) {
+          host.timer = heartbeat_expiry.schedule(it->first, monotonic_ms() + MONITORING_HEARTBEAT_TIMEOUT_MS);
+        }
+        else {
+          uint32_t lost;
+          HeartbeatOrder order = heartbeat_order(host.sequence, heartbeat.sequence, lost);
+          if (order == HEARTBEAT_STALE && !(flags & FRAME_FLAG_LEAVING)) {
+            return;
+          }
+          Metrics::add(Metrics::MONITORING_HEARTBEATS_LOST, lost);
+          restarted = order == HEARTBEAT_RESTART;
+          heartbeat_expiry.reschedule(host.timer, monotonic_ms() + MONITORING_HEARTBEAT_TIMEOUT_MS);
         }
+        host.sequence = heartbeat.sequence;
 
-        auto &[host, participant] = *it;
-        char buffer[1024];
-        int read = recv(file_descriptor, ARRAY_POSTFIXLEN(buffer), 0);
-        
-        result |= read;
-        if (errno == EPIPE) {
-          to_remove.push_back(host);
-          ms->participants->dirty = true;
-          continue;
+        status_event_t event = {};
+        event.timestamp = time(NULL);
+        event.machine.hostname = heartbeat.hostname;
+        if (flags & FRAME_FLAG_LEAVING) {
+          event.kind = STATUS_LEFT;
+          event.session = host.session;
+          forget_host(it);
+          ms->participants->publish(event);
+          return;
+        }
+        // A new host, one that moved or one that restarted gets a new session, the same way a fresh connection would
+        if (created || restarted || host.address != sender.sin_addr.s_addr) {
+          host.session = ms->next_session_id.fetch_add(1, std::memory_order_relaxed);
+          host.address = sender.sin_addr.s_addr;
+          host.last_published = event.timestamp;
+          host.hostname = heartbeat.hostname;
+          event.kind = STATUS_JOINED;
+          event.session = host.session;
+          event.machine.address = sender.sin_addr.s_addr;
+          event.machine.port = ntohs(sender.sin_port);
+          event.machine.mac = heartbeat.mac;
+          event.machine.hostname = heartbeat.hostname;
+          Metrics::set(Metrics::HEARTBEAT_HOSTS, heartbeat_hosts.size());
+          ms->participants->publish(event);
+          return;
+        }
+        if (host.last_published != event.timestamp) {
+          host.last_published = event.timestamp;
+          event.kind = STATUS_SEEN;
+          event.session = host.session;
+          ms->participants->publish(event);
+        }
+      };
+
+      // A host that went silent is asleep, it rejoins with a new session when its heartbeats come back
+      auto on_heartbeat_expired = [&](uint32_t timer)
+      {
+        auto it = heartbeat_hosts.find(heartbeat_expiry[timer]);
+        if (it == heartbeat_hosts.end()) {
+          heartbeat_expiry.cancel(timer);
+          return;
         }
+        status_event_t event = {};
+        event.kind = STATUS_ASLEEP;
+        event.session = it->second.session;
+        event.timestamp = time(NULL);
+        event.machine.hostname = it->second.hostname;
+        forget_host(it);
+        ms->participants->publish(event);
+      };
 
-        if (result < 0) {
-          perrorcode("recv");
-          continue;
+      // Sends the next probe or gives up on a participant that stopped answering
+      // Sleeping participants are not probed at all, their session is closed and they are left to reconnect
+      auto on_probe_due = [&](uint32_t timer)
+      {
+        uint64_t id = probes[timer];
+        auto it = sessions.find(id);
+        if (it == sessions.end()) {
+          probes.cancel(timer);
+          return;
         }
+        monitoring_session_t &session = it->second;
+        // Nothing to probe yet, a connection that never says hello would otherwise hold its fd and ring forever
+        if (session.host.empty()) {
+          close_session(id, false);
+          return;
+        }
+        if (session.missed >= MONITORING_PROBE_MISSES) {
+          Metrics::add(Metrics::MONITORING_PROBE_TIMEOUTS);
+          close_session(id, false);
+          return;
+        }
+        unsigned char probe[WIRE_MAX_FRAME];
+        // The token is the send time, a reply echoes it back so the round trip needs no per probe state
+        size_t probe_length = frame_encode_probe(probe, sizeof(probe), MESSAGE_PROBE, (uint64_t)monotonic_us());
+        // A probe that does not fit behind a backlog still counts as missed, the next one carries a fresh token anyway
+        // A peer that is gone comes back from the engine as a hangup
+        if (engine->send(id, probe, probe_length) == 0) {
+          Metrics::add(Metrics::MONITORING_PROBES_SENT);
+        }
+        session.missed++;
+        probes.reschedule(timer, monotonic_ms() + MONITORING_PROBE_TIMEOUT_MS);
+      };
 
-        if (result == 0) {
-          std::cerr << "No Data avaliable to read" << std::endl;
-          continue;
+      // Frames are handed to the session one event at a time, false when the session has to go
+      auto on_bytes = [&](monitoring_session_t &session, const unsigned char *data, size_t length, bool &left) -> bool
+      {
+        while (length > 0) {
+          size_t taken = session.decoder.feed(data, length);
+          data += taken;
+          length -= taken;
+          Frame frame;
+          FrameResult frame_result;
+          while ((frame_result = session.decoder.next(frame)) == FRAME_READY) {
+            Metrics::add(Metrics::MONITORING_FRAMES);
+            if (frame.type == MESSAGE_PROBE_REPLY) {
+              uint64_t token;
+              if (frame_parse_probe(frame, token) && !session.host.empty()) {
+                Metrics::add(Metrics::MONITORING_PROBE_REPLIES);
+                Metrics::record(Metrics::PROBE_RTT_US, monotonic_us() - (int64_t)token);
+                on_reply(session);
+              }
+            }
+            else if (frame.type == MESSAGE_HELLO) {
+              HelloMessage hello;
+              if (!frame_parse_hello(frame, hello)) {
+                return false;
+              }
+              adopt(session, hello);
+            }
+            else if (frame.type == MESSAGE_EXIT) {
+              left = true;
+              return false;
+            }
+          }
+          if (frame_result == FRAME_ERROR) {
+            std::cerr << "[ERROR] Malformed frame from " << session.endpoint.to_string() << std::endl;
+            return false;
+          }
         }
+        return true;
+      };
 
-        if (string_equals(string(buffer, read), "exit")) {
-          to_remove.push_back(host);
-          ms->participants->dirty = true;
+      while(ms->running)
+      {
+        probes.advance(monotonic_ms(), on_probe_due);
+        heartbeat_expiry.advance(monotonic_ms(), on_heartbeat_expired);
+        int ready = engine->wait(events, MONITORING_MAX_EVENTS, MONITORING_PROBE_RESOLUTION_MS);
+        if (ready < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          perrorcode("io engine wait");
+          break;
         }
 
-        participant.last_conection_timestamp = unix_epoch_now;
-        //participant.socket->close();
-      }
+        for (int i = 0; i < ready; i++) {
+          io_event_t &event = events[i];
+          if (event.kind == IO_DATAGRAM) {
+            Metrics::add(Metrics::MONITORING_HEARTBEATS);
+            Frame frame;
+            HeartbeatMessage heartbeat;
+            if (!(event.flags & MSG_TRUNC) &&
+                frame_decode(event.data, event.length, frame) == FRAME_READY &&
+                frame_parse_heartbeat(frame, heartbeat)) {
+              on_heartbeat(heartbeat, frame.flags, event.address);
+            }
+            continue;
+          }
+          if (event.kind == IO_ACCEPTED) {
+            Socket client_socket(event.file_descriptor);
+            // Ids are unique across workers, the table uses them to drop events from superseded sessions
+            uint64_t id = ms->next_session_id.fetch_add(1, std::memory_order_relaxed);
+            if (engine->receive(client_socket.file_descriptor, id) < 0) {
+              perrorcode("io engine receive");
+              continue;
+            }
+            monitoring_session_t &session = sessions[id];
+            session.id = id;
+            session.socket = std::move(client_socket);
+            memcpy(&session.endpoint.socket_address, &event.address, sizeof(event.address));
+            session.endpoint.address_length = sizeof(event.address);
+            session.probe_timer = probes.schedule(id, monotonic_ms() + MONITORING_HELLO_TIMEOUT_MS);
+            Metrics::add(Metrics::MONITORING_ACCEPTS);
+            Metrics::adjust(Metrics::MONITORING_SESSIONS, 1);
+            continue;
+          }
 
-      for (auto host : to_remove) {
-        ms->participants->remove(host);
+          auto it = sessions.find(event.tag);
+          if (it == sessions.end()) {
+            continue;
+          }
+          monitoring_session_t &session = it->second;
+          bool left = false;
+          if (event.kind == IO_CLOSED) {
+            if (event.error != 0) {
+              errno = event.error;
+              perrorcode("recv");
+            }
+            close_session(session.id, false);
+            continue;
+          }
+          if (!on_bytes(session, event.data, event.length, left)) {
+            close_session(session.id, left);
+            continue;
+          }
+          // The table keeps second resolution, so one event per second per session is enough unless the deadline moved
+          time_t unix_epoch_now = time(NULL);
+          if (!session.host.empty() &&
+              (session.last_published != unix_epoch_now || session.published_deadline_ms != liveness_deadline(session))) {
+            session.last_published = unix_epoch_now;
+            publish(STATUS_SEEN, session);
+          }
+        }
       }
-      
-      ms->participants->unlock();
-      msleep(300); // Let other threads get the GODDAMN MUTEX
-    }
-    ms->running = false;
-    return NULL; }, this);
+      if (strcmp(engine->name(), "io_uring") == 0) {
+        Metrics::adjust(Metrics::IO_URING_WORKERS, -1);
+      }
+      return NULL; }, &shard);
+  }
 }
 
 void MonitoringService::start_client(const IpEndpoint &server_machine)
@@ -187,56 +537,237 @@ void MonitoringService::start_client(const IpEndpoint &server_machine)
   }
   running = true;
   this->server_machine = server_machine.with_port(port);
+  lost = false;
+  if (heartbeat)
+  {
+    start_heartbeat();
+    return;
+  }
+  joinable = true;
   pthread_create(&thread, NULL, [](void *data) -> void *
                  {
     MonitoringService *ms = (MonitoringService *)data;
     Socket &client_socket = ms->tcp_socket;
-    int result = client_socket.open(SocketType::Stream, SocketProtocol::TCP);
-    result |= client_socket.connect(ms->server_machine);
-    
-    std::string cmd;
-    while (ms->running)
+    string hostname = get_hostname();
+    unsigned char hello[WIRE_MAX_FRAME];
+    Backoff backoff(MONITORING_RECONNECT_BASE_MS, MONITORING_RECONNECT_CAP_MS, MacAddress::get_mac().key() ^ monotonic_ns());
+    FrameDecoder decoder;
+    MonitoringClientState state = CLIENT_IDLE;
+    int64_t deadline = monotonic_ms(); // next attempt, connect timeout or silence limit depending on the state
+    int failures = 0;                  // attempts in a row that never heard from the manager
+    bool heard = false;
+
+    // Every way a connection ends leads back to idle after a jittered, growing delay
+    auto fail = [&]()
     {
-      if (result < 0)
-      {
-        perror("connect");
-        return NULL;
+      client_socket.close();
+      decoder.reset();
+      failures = heard ? 0 : failures + 1;
+      heard = false;
+      state = CLIENT_IDLE;
+      deadline = monotonic_ms() + backoff.next_delay();
+    };
+
+    auto connected = [&]()
+    {
+      // The mac address of the card the connection leaves from is the one the manager can wake
+      size_t hello_length = frame_encode_hello(hello, sizeof(hello), MacAddress::for_socket(client_socket.file_descriptor), hostname);
+      if (client_socket.send(hello, hello_length, MSG_NOSIGNAL) < 0) {
+        fail();
+        return;
       }
-      result = client_socket.recv(&cmd);
-      if (result == 0) {
-        client_socket.close();
-        result = client_socket.open(SocketType::Stream, SocketProtocol::TCP);
-        result |= client_socket.connect(ms->server_machine);
-        continue;
+      state = CLIENT_CONNECTED;
+      deadline = monotonic_ms() + MONITORING_CLIENT_SILENCE_MS;
+    };
+
+    // Waits in short slices so stop() is noticed, returns the poll events or 0 on a timeout
+    auto wait_for = [&](short events) -> short
+    {
+      int64_t remaining = std::max<int64_t>(deadline - monotonic_ms(), 0);
+      pollfd ready = {.fd = client_socket.file_descriptor, .events = events, .revents = 0};
+      if (::poll(&ready, 1, (int)std::min<int64_t>(remaining, MONITORING_CLIENT_TICK_MS)) <= 0) {
+        return 0;
       }
-      else if (result < 0) {
-        perrorcode("recv");
-        continue;
+      return ready.revents;
+    };
+
+    while (ms->running)
+    {
+      if (state == CLIENT_IDLE)
+      {
+        int64_t remaining = deadline - monotonic_ms();
+        if (remaining > 0) {
+          msleep(std::min<int64_t>(remaining, MONITORING_CLIENT_TICK_MS));
+          continue;
+        }
+        // The old endpoint stayed dead, discovery has to find out where the manager went
+        if (failures >= MONITORING_REDISCOVER_AFTER) {
+          ms->lost = true;
+          break;
+        }
+        int result = client_socket.open(SocketType(SocketType::Stream | SocketType::NonBlocking), SocketProtocol::TCP);
+        if (result >= 0) {
+          result = client_socket.connect(ms->server_machine);
+        }
+        if (result == 0) {
+          connected();
+        }
+        else if (errno == EINPROGRESS) {
+          state = CLIENT_CONNECTING;
+          deadline = monotonic_ms() + MONITORING_CONNECT_TIMEOUT_MS;
+        }
+        else {
+          fail();
+        }
       }
-      if (cmd == "probe from server")
+      else if (state == CLIENT_CONNECTING)
       {
-        msleep(1000);
-        result |= client_socket.send("probe from client");
-        if (result == 0){
+        short events = wait_for(POLLOUT);
+        if (events == 0) {
+          if (monotonic_ms() >= deadline) {
+            fail();
+          }
           continue;
         }
-        else if (result < 0) {
-          perrorcode("recv");
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(client_socket.file_descriptor, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+          fail();
+          continue;
         }
+        connected();
       }
-      else if (cmd == "exit") {
-        ms->running = false;
-        return NULL;
+      else if (state == CLIENT_CONNECTED)
+      {
+        short events = wait_for(POLLIN);
+        if (events == 0) {
+          // Not even a slow probe came through, the manager dropped this session while the machine was asleep
+          if (monotonic_ms() >= deadline) {
+            fail();
+          }
+          continue;
+        }
+        int result = decoder.read_from(client_socket.file_descriptor);
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          continue;
+        }
+        if (result <= 0) {
+          fail();
+          continue;
+        }
+
+        Frame frame;
+        FrameResult frame_result;
+        while ((frame_result = decoder.next(frame)) == FRAME_READY)
+        {
+          if (!heard) {
+            heard = true;
+            backoff.reset();
+          }
+          deadline = monotonic_ms() + MONITORING_CLIENT_SILENCE_MS;
+          if (frame.type == MESSAGE_PROBE)
+          {
+            uint64_t token;
+            if (!frame_parse_probe(frame, token)) {
+              continue;
+            }
+            unsigned char reply[WIRE_MAX_FRAME];
+            size_t reply_length = frame_encode_probe(reply, sizeof(reply), MESSAGE_PROBE_REPLY, token);
+            // A reply the socket cannot take right now is simply missed, the next probe asks again
+            if (client_socket.send(reply, reply_length, MSG_NOSIGNAL) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+              perrorcode("send");
+            }
+          }
+          else if (frame.type == MESSAGE_EXIT) {
+            ms->running = false;
+            return NULL;
+          }
+        }
+        if (frame_result == FRAME_ERROR) {
+          std::cerr << "[ERROR] Malformed frame from manager" << std::endl;
+          fail();
+        }
       }
     }
+    client_socket.close();
     ms->running = false;
     return NULL; }, this);
 }
 
+// Replies a participant owes before its probes slow down, doubled each time it comes back soon after the last time
+int MonitoringService::probe_settle(const MacAddress &mac)
+{
+  int64_t now = monotonic_ms();
+  std::lock_guard<std::mutex> guard(churn_lock);
+  auto [it, created] = churn.try_emplace(mac.key(), probe_churn_t{now, MONITORING_PROBE_SETTLE});
+  probe_churn_t &entry = it->second;
+  if (!created)
+  {
+    bool flapping = now - entry.changed_at_ms < MONITORING_PROBE_FLAP_WINDOW_MS;
+    entry.settle = flapping ? std::min(entry.settle * 2, MONITORING_PROBE_SETTLE_MAX) : MONITORING_PROBE_SETTLE;
+    entry.changed_at_ms = now;
+  }
+  return entry.settle;
+}
+
+// Heartbeat mode of the client, nothing is ever read back
+void MonitoringService::start_heartbeat()
+{
+  int result = udp_socket.open(SocketType::Datagram, SocketProtocol::UDP);
+  result |= udp_socket.connect(server_machine);
+  if (result < 0)
+  {
+    perrorcode("heartbeat");
+    running = false;
+    return;
+  }
+  heartbeat_mac = MacAddress::for_socket(udp_socket.file_descriptor);
+  leave_frame_length = frame_encode_heartbeat(leave_frame, sizeof(leave_frame), heartbeat_mac, 0, get_hostname(), FRAME_FLAG_LEAVING);
+  joinable = true;
+  pthread_create(&thread, NULL, [](void *data) -> void *
+                 {
+    MonitoringService *ms = (MonitoringService *)data;
+    MacAddress mac = ms->heartbeat_mac;
+    string hostname = get_hostname();
+    unsigned char frame[WIRE_MAX_FRAME];
+    // Sequence numbers start at a random point, so a restart lands outside the sequence window of the manager and counts as a rejoin
+    uint32_t sequence = std::random_device()();
+    while (ms->running)
+    {
+      size_t length = frame_encode_heartbeat(frame, sizeof(frame), mac, sequence++, hostname);
+      if (ms->udp_socket.send(frame, length) < 0 && errno != ECONNREFUSED) {
+        perrorcode("heartbeat");
+      }
+      msleep(MONITORING_HEARTBEAT_INTERVAL_MS);
+    }
+    return NULL; }, this);
+}
+
+// Tells the other side this participant is leaving, safe to call from a signal handler
+int MonitoringService::send_exit()
+{
+  if (heartbeat)
+  {
+    return udp_socket.send(leave_frame, leave_frame_length);
+  }
+  unsigned char exit_frame[WIRE_HEADER_SIZE];
+  size_t length = frame_encode(exit_frame, sizeof(exit_frame), MESSAGE_EXIT, NULL, 0);
+  return tcp_socket.send(exit_frame, length, MSG_NOSIGNAL);
+}
+
 void MonitoringService::stop()
 {
   running = false;
-  pthread_join(thread, NULL);
+  if (joinable)
+  {
+    pthread_join(thread, NULL);
+    joinable = false;
+  }
+  for (monitoring_worker_t &shard : shards)
+  {
+    pthread_join(shard.thread, NULL);
+  }
+  shards.clear();
 }
 
 #endif // MONITORING_SERVICE_IMPLEMENTATION
@@ -56,3 +56,14 @@ struct StringHashIgnoreCase
         return hash_function(str);
     }
 };
+
+// FNV-1a over the upper cased bytes, without copying the string
+static inline uint64_t ascii_hash_ignore_case(std::string_view str)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (char ch : str)
+    {
+        hash = (hash ^ (unsigned char)ascii_toupper(ch)) * 0x100000001b3ull;
+    }
+    return hash;
+}
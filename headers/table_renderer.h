@@ -0,0 +1,246 @@
+/*
+  Retained mode renderer for the manager participant table
+  The renderer remembers what every row on the terminal shows and rewrites only the cells whose value changed, using cursor addressing escapes
+  The whole screen is only repainted on the first frame, after something else wrote to the terminal or when the terminal is resized
+  Frames are capped at a configurable rate and each frame goes out in a single write, so the cost follows the changes and not the table size
+*/
+#ifndef TABLE_RENDERER_H_
+#define TABLE_RENDERER_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include "macros.h"
+#include "management.hpp"
+#include "metrics.h"
+
+#define TABLE_RENDERER_DEFAULT_FPS 10
+#define TABLE_COLUMN_HOSTNAME 1
+#define TABLE_COLUMN_MAC 17
+#define TABLE_COLUMN_ADDRESS 41
+#define TABLE_COLUMN_STATUS 65
+#define TABLE_COLUMN_LAST_CONNECTION 81
+#define TABLE_LAST_CONNECTION_WIDTH 24
+
+// What one terminal row shows, kept as raw values so unchanged cells are skipped without formatting them
+typedef struct rendered_row_t
+{
+  InlineString<MACHINE_HOSTNAME_MAX> hostname;
+  MacAddress mac;
+  in_addr_t address;
+  bool status;
+  time_t last_conection_timestamp;
+} rendered_row_t;
+
+struct TableRenderer
+{
+  string header; // printed above the table on a full repaint
+  int64_t frame_interval_ms = 1000 / TABLE_RENDERER_DEFAULT_FPS;
+
+  void set_fps(int fps);
+  void invalidate();
+  bool draw(const ParticipantSnapshot &snapshot);
+  int64_t next_frame_at_ms() const;
+
+private:
+  std::vector<rendered_row_t> rows; // what the terminal currently shows
+  int64_t next_frame_ms = 0;
+  bool repaint = true;
+  int height = -1;     // terminal rows, 0 when stdout is not a terminal
+  int footer_row = 0;  // where the hidden row count is shown, 0 when it is not
+  string out;
+
+  void move_to(int row, int column);
+  void cell(int row, int column, const char *text, int width);
+};
+
+#endif // TABLE_RENDERER_H_
+#ifdef TABLE_RENDERER_IMPLEMENTATION
+
+void TableRenderer::set_fps(int fps)
+{
+  frame_interval_ms = fps > 0 ? 1000 / fps : 1000 / TABLE_RENDERER_DEFAULT_FPS;
+}
+
+// The next frame repaints the whole screen, for when something else wrote to the terminal
+void TableRenderer::invalidate()
+{
+  repaint = true;
+}
+
+// When a frame held back by the rate cap may be drawn
+int64_t TableRenderer::next_frame_at_ms() const
+{
+  return next_frame_ms;
+}
+
+void TableRenderer::move_to(int row, int column)
+{
+  char escape[32];
+  int length = snprintf(escape, sizeof(escape), "\033[%d;%dH", row, column);
+  out.append(escape, length);
+}
+
+// Writes a cell padded to its width so a shorter value covers a longer one
+void TableRenderer::cell(int row, int column, const char *text, int width)
+{
+  move_to(row, column);
+  size_t length = strlen(text);
+  out.append(text, length);
+  if ((int)length < width)
+  {
+    out.append(width - length, ' ');
+  }
+}
+
+// Brings the terminal up to date with the snapshot, false when the frame is not due yet
+bool TableRenderer::draw(const ParticipantSnapshot &snapshot)
+{
+  int64_t now = monotonic_ms();
+  if (now < next_frame_ms)
+  {
+    return false;
+  }
+  next_frame_ms = now + frame_interval_ms;
+  out.clear();
+
+  winsize window = {};
+  int terminal_height = ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 ? window.ws_row : 0;
+  if (terminal_height != height)
+  {
+    height = terminal_height;
+    repaint = true;
+  }
+  int header_lines = std::count(header.begin(), header.end(), '\n');
+  int first_row = header_lines + 3; // below the header, the title and the column names
+  if (repaint)
+  {
+    out += "\033[2J\033[H";
+    out += header;
+    out += "\t\t\t\033[1mManagement Table\033[0m";
+    move_to(first_row - 1, TABLE_COLUMN_HOSTNAME);
+    out += "\033[1mHost name";
+    move_to(first_row - 1, TABLE_COLUMN_MAC);
+    out += "Mac address";
+    move_to(first_row - 1, TABLE_COLUMN_ADDRESS);
+    out += "Ip address";
+    move_to(first_row - 1, TABLE_COLUMN_STATUS);
+    out += "status";
+    move_to(first_row - 1, TABLE_COLUMN_LAST_CONNECTION);
+    out += "Last conection\033[0m";
+    rows.clear();
+    footer_row = 0;
+    repaint = false;
+  }
+
+  // The last terminal line is left for typing commands
+  size_t total = snapshot.participants.size();
+  size_t capacity = height > 0 ? (size_t)std::max(height - first_row, 0) : total;
+  size_t visible = std::min(total, capacity);
+  if (visible < total && visible > 0)
+  {
+    visible--; // room for the hidden row count
+  }
+
+  if (footer_row != 0)
+  {
+    move_to(footer_row, TABLE_COLUMN_HOSTNAME);
+    out += "\033[2K";
+    footer_row = 0;
+  }
+  for (size_t i = rows.size(); i > visible; i--)
+  {
+    move_to(first_row + i - 1, TABLE_COLUMN_HOSTNAME);
+    out += "\033[2K";
+  }
+  if (rows.size() > visible)
+  {
+    rows.resize(visible);
+  }
+
+  for (size_t i = 0; i < visible; i++)
+  {
+    const participant_t &participant = snapshot.participants[i];
+    const MachineEndpoint &machine = participant.machine;
+    in_addr_t address = machine.address;
+    int row = first_row + i;
+    bool fresh = i >= rows.size();
+    if (fresh)
+    {
+      rows.push_back(rendered_row_t{});
+      move_to(row, TABLE_COLUMN_HOSTNAME);
+      out += "\033[2K";
+    }
+    rendered_row_t &shown = rows[i];
+    if (fresh || shown.hostname != machine.hostname)
+    {
+      shown.hostname = machine.hostname;
+      cell(row, TABLE_COLUMN_HOSTNAME, shown.hostname.c_str(), TABLE_COLUMN_MAC - TABLE_COLUMN_HOSTNAME - 1);
+    }
+    if (fresh || !(shown.mac == machine.mac))
+    {
+      shown.mac = machine.mac;
+      cell(row, TABLE_COLUMN_MAC, shown.mac.str().c_str(), TABLE_COLUMN_ADDRESS - TABLE_COLUMN_MAC - 1);
+    }
+    if (fresh || shown.address != address)
+    {
+      shown.address = address;
+      char text[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &address, text, sizeof(text));
+      cell(row, TABLE_COLUMN_ADDRESS, text, TABLE_COLUMN_STATUS - TABLE_COLUMN_ADDRESS - 1);
+    }
+    if (fresh || shown.status != participant.status)
+    {
+      shown.status = participant.status;
+      cell(row, TABLE_COLUMN_STATUS, shown.status ? "awake" : "sleeping", TABLE_COLUMN_LAST_CONNECTION - TABLE_COLUMN_STATUS - 1);
+    }
+    if (fresh || shown.last_conection_timestamp != participant.last_conection_timestamp)
+    {
+      shown.last_conection_timestamp = participant.last_conection_timestamp;
+      struct tm tm;
+      localtime_r(&shown.last_conection_timestamp, &tm);
+      char text[64];
+      snprintf(text, sizeof(text), "%d/%d/%d %d:%d.%d",
+               tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+      cell(row, TABLE_COLUMN_LAST_CONNECTION, text, TABLE_LAST_CONNECTION_WIDTH);
+    }
+  }
+
+  int next_row = first_row + visible;
+  if (visible < total)
+  {
+    footer_row = next_row++;
+    char text[64];
+    snprintf(text, sizeof(text), "... and %zu more", total - visible);
+    cell(footer_row, TABLE_COLUMN_HOSTNAME, text, 0);
+  }
+  move_to(next_row, 1);
+
+  // Whatever commands printed has to reach the terminal before the escapes that assume where the cursor is
+  std::cout.flush();
+  fflush(stdout);
+  size_t written = 0;
+  while (written < out.size())
+  {
+    ssize_t result = ::write(STDOUT_FILENO, out.data() + written, out.size() - written);
+    if (result < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (result < 0)
+    {
+      break;
+    }
+    written += result;
+  }
+  Metrics::add(Metrics::UI_FRAMES);
+  Metrics::add(Metrics::UI_BYTES, written);
+  return true;
+}
+
+#endif // TABLE_RENDERER_IMPLEMENTATION
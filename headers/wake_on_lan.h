@@ -0,0 +1,141 @@
+/*
+  Builds and sends Wake-on-LAN magic packets without leaving the process
+  A magic packet is 6 bytes of 0xff followed by 16 repetitions of the target mac address
+  Packets for many hosts are pushed through a single broadcast socket in one sendmmsg batch
+*/
+#ifndef WAKE_ON_LAN_H_
+#define WAKE_ON_LAN_H_
+
+#include <vector>
+#include <algorithm>
+#include <sys/socket.h>
+#include "macros.h"
+#include "Net/Socket.hpp"
+#include "management.hpp"
+
+#define MAGIC_PACKET_SYNC_LEN 6
+#define MAGIC_PACKET_REPEAT 16
+#define MAGIC_PACKET_SIZE (MAGIC_PACKET_SYNC_LEN + MAGIC_PACKET_REPEAT * MAC_ADDR_MAX)
+#define WAKE_ON_LAN_PORT 9
+#define WAKE_ON_LAN_BATCH 64
+
+struct MagicPacket
+{
+  unsigned char bytes[MAGIC_PACKET_SIZE];
+
+  static MagicPacket build(const MacAddress &mac);
+};
+
+struct WakeOnLanSender
+{
+  Socket udp_socket;
+  std::vector<IpEndpoint> targets;
+
+  int open(bool directed_broadcast = true);
+  int wake(const MacAddress &mac);
+  int wake(const std::vector<MacAddress> &macs);
+};
+
+#endif // WAKE_ON_LAN_H_
+#ifdef WAKE_ON_LAN_IMPLEMENTATION
+
+MagicPacket MagicPacket::build(const MacAddress &mac)
+{
+  MagicPacket packet;
+  memset(packet.bytes, 0xff, MAGIC_PACKET_SYNC_LEN);
+  for (int i = 0; i < MAGIC_PACKET_REPEAT; i++)
+  {
+    memcpy(packet.bytes + MAGIC_PACKET_SYNC_LEN + i * MAC_ADDR_MAX, mac.mac_addr, MAC_ADDR_MAX);
+  }
+  return packet;
+}
+
+// Opens the broadcast socket once and collects where packets are sent
+// With directed broadcast every broadcast capable interface gets its own subnet broadcast address
+int WakeOnLanSender::open(bool directed_broadcast)
+{
+  if (udp_socket.file_descriptor != -1)
+  {
+    return 0;
+  }
+  int result = udp_socket.open(AddressFamily::InterNetwork, SocketType::Datagram, SocketProtocol::UDP);
+  result |= udp_socket.set_option(SO_BROADCAST, 1);
+  if (result < 0)
+  {
+    perrorcode("wake on lan open");
+    udp_socket.close();
+    return -1;
+  }
+
+  targets.clear();
+  if (directed_broadcast)
+  {
+    for (const Net::BroadcastInterface &network_interface : Net::broadcast_interfaces())
+    {
+      IpEndpoint target = IpEndpoint(ntohl(network_interface.broadcast), WAKE_ON_LAN_PORT);
+      if (std::find(targets.begin(), targets.end(), target) == targets.end())
+      {
+        targets.push_back(target);
+      }
+    }
+  }
+  if (targets.empty())
+  {
+    targets.push_back(IpEndpoint::broadcast(WAKE_ON_LAN_PORT));
+  }
+  return 0;
+}
+
+int WakeOnLanSender::wake(const MacAddress &mac)
+{
+  return wake(std::vector<MacAddress>{mac});
+}
+
+// Sends one magic packet per mac address to every target, returns the number of datagrams sent
+// Every (mac address, target) pair is one datagram, batches are cut from that flat sequence so any number of targets fits
+int WakeOnLanSender::wake(const std::vector<MacAddress> &macs)
+{
+  if (open() < 0)
+  {
+    return -1;
+  }
+
+  MagicPacket packets[WAKE_ON_LAN_BATCH];
+  iovec iovecs[WAKE_ON_LAN_BATCH];
+  mmsghdr messages[WAKE_ON_LAN_BATCH];
+  int total_sent = 0;
+  size_t total = macs.size() * targets.size();
+
+  for (size_t first = 0; first < total; first += WAKE_ON_LAN_BATCH)
+  {
+    unsigned int pending = std::min<size_t>(WAKE_ON_LAN_BATCH, total - first);
+    for (unsigned int i = 0; i < pending; i++)
+    {
+      const MacAddress &mac = macs[(first + i) / targets.size()];
+      const IpEndpoint &target = targets[(first + i) % targets.size()];
+      packets[i] = MagicPacket::build(mac);
+      iovecs[i] = iovec{.iov_base = packets[i].bytes, .iov_len = MAGIC_PACKET_SIZE};
+      messages[i] = mmsghdr{};
+      messages[i].msg_hdr.msg_name = (void *)&target.socket_address;
+      messages[i].msg_hdr.msg_namelen = target.address_length;
+      messages[i].msg_hdr.msg_iov = &iovecs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    // A short result leaves the tail of the batch unsent, it is retried until the socket reports an error
+    unsigned int done = 0;
+    while (done < pending)
+    {
+      int sent = udp_socket.send_batch(messages + done, pending - done);
+      if (sent <= 0)
+      {
+        perrorcode("wake on lan sendmmsg");
+        return total_sent > 0 ? total_sent : -1;
+      }
+      done += sent;
+      total_sent += sent;
+    }
+  }
+  return total_sent;
+}
+
+#endif // WAKE_ON_LAN_IMPLEMENTATION
@@ -0,0 +1,292 @@
+/*
+  Binary wire protocol spoken between the manager and the participants over the monitoring channel
+  Every frame starts with a fixed header carrying a magic byte, the protocol version, the message type and the payload length
+  Multi byte fields are sent in network byte order
+  Heartbeats use the same framing but travel as one frame per UDP datagram
+  The decoder keeps partial frames between reads in a ring buffer, so split or coalesced TCP segments decode the same way
+  Decoded frames point into the decoder buffer and are valid until the next read or the next decoded frame
+*/
+#ifndef WIRE_PROTOCOL_H_
+#define WIRE_PROTOCOL_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <algorithm>
+#include <sys/socket.h>
+#include "macros.h"
+#include "management.hpp"
+#include "DataStructures/ByteRing.h"
+
+#define WIRE_MAGIC 0x5c
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 6
+#define WIRE_MAX_HOSTNAME 255
+#define WIRE_MAX_PAYLOAD (MAC_ADDR_MAX + sizeof(uint32_t) + 1 + WIRE_MAX_HOSTNAME)
+#define WIRE_MAX_FRAME (WIRE_HEADER_SIZE + WIRE_MAX_PAYLOAD)
+#define FRAME_DECODER_CAPACITY 1024
+#define HEARTBEAT_SEQUENCE_WINDOW 64 // how far a heartbeat may stray from the last one and still belong to the same run of the sender
+
+enum MessageType : uint8_t
+{
+  MESSAGE_HELLO = 1,       // participant -> manager: mac address and hostname
+  MESSAGE_PROBE = 2,       // manager -> participant: opaque 64 bit token
+  MESSAGE_PROBE_REPLY = 3, // participant -> manager: the probe token echoed back
+  MESSAGE_EXIT = 4,        // either side is leaving the service
+  MESSAGE_HEARTBEAT = 5,   // participant -> manager over UDP: mac address, sequence number and hostname
+};
+
+enum FrameFlags : uint8_t
+{
+  FRAME_FLAG_LEAVING = 1, // on a heartbeat, the participant is leaving the service
+};
+
+typedef struct Frame
+{
+  MessageType type;
+  uint8_t flags;
+  uint16_t length;
+  const unsigned char *payload;
+} Frame;
+
+// Hello payload, hostname points into the frame it was parsed from
+typedef struct HelloMessage
+{
+  MacAddress mac;
+  string_view hostname;
+} HelloMessage;
+
+// Heartbeat payload, hostname points into the frame it was parsed from
+typedef struct HeartbeatMessage
+{
+  MacAddress mac;
+  uint32_t sequence;
+  string_view hostname;
+} HeartbeatMessage;
+
+size_t frame_encode(unsigned char *buffer, size_t capacity, MessageType type, const void *payload, uint16_t length, uint8_t flags = 0);
+size_t frame_encode_hello(unsigned char *buffer, size_t capacity, const MacAddress &mac, string_view hostname);
+size_t frame_encode_probe(unsigned char *buffer, size_t capacity, MessageType type, uint64_t token);
+size_t frame_encode_heartbeat(unsigned char *buffer, size_t capacity, const MacAddress &mac, uint32_t sequence, string_view hostname, uint8_t flags = 0);
+bool frame_parse_hello(const Frame &frame, HelloMessage &hello);
+bool frame_parse_probe(const Frame &frame, uint64_t &token);
+bool frame_parse_heartbeat(const Frame &frame, HeartbeatMessage &heartbeat);
+
+enum HeartbeatOrder
+{
+  HEARTBEAT_NEXT,    // newer than the last one, the sequence numbers skipped in between were lost
+  HEARTBEAT_STALE,   // duplicated or reordered
+  HEARTBEAT_RESTART, // too far from the last one in either direction, the sender started over
+};
+
+HeartbeatOrder heartbeat_order(uint32_t last, uint32_t sequence, uint32_t &lost);
+
+enum FrameResult
+{
+  FRAME_ERROR = -1,
+  FRAME_INCOMPLETE = 0,
+  FRAME_READY = 1,
+};
+
+FrameResult frame_decode(const unsigned char *datagram, size_t size, Frame &frame);
+
+struct FrameDecoder
+{
+  static_assert(FRAME_DECODER_CAPACITY >= 2 * WIRE_MAX_FRAME, "the decoder must hold a partial frame and a whole one");
+
+  ByteRing<FRAME_DECODER_CAPACITY> input;
+  unsigned char scratch[WIRE_MAX_PAYLOAD]; // payloads that wrap around the ring are copied here
+
+  int read_from(int file_descriptor);
+  size_t feed(const unsigned char *data, size_t length);
+  FrameResult next(Frame &frame);
+  void reset();
+};
+
+#endif // WIRE_PROTOCOL_H_
+#ifdef WIRE_PROTOCOL_IMPLEMENTATION
+
+size_t frame_encode(unsigned char *buffer, size_t capacity, MessageType type, const void *payload, uint16_t length, uint8_t flags)
+{
+  if (length > WIRE_MAX_PAYLOAD || capacity < (size_t)WIRE_HEADER_SIZE + length)
+  {
+    return 0;
+  }
+  uint16_t network_length = htons(length);
+  buffer[0] = WIRE_MAGIC;
+  buffer[1] = WIRE_VERSION;
+  buffer[2] = type;
+  buffer[3] = flags;
+  memcpy(buffer + 4, &network_length, sizeof(network_length));
+  if (length > 0)
+  {
+    memcpy(buffer + WIRE_HEADER_SIZE, payload, length);
+  }
+  return WIRE_HEADER_SIZE + length;
+}
+
+size_t frame_encode_hello(unsigned char *buffer, size_t capacity, const MacAddress &mac, string_view hostname)
+{
+  unsigned char payload[WIRE_MAX_PAYLOAD];
+  size_t hostname_length = std::min<size_t>(hostname.size(), WIRE_MAX_HOSTNAME);
+  memcpy(payload, mac.mac_addr, MAC_ADDR_MAX);
+  payload[MAC_ADDR_MAX] = (unsigned char)hostname_length;
+  memcpy(payload + MAC_ADDR_MAX + 1, hostname.data(), hostname_length);
+  return frame_encode(buffer, capacity, MESSAGE_HELLO, payload, MAC_ADDR_MAX + 1 + hostname_length);
+}
+
+size_t frame_encode_probe(unsigned char *buffer, size_t capacity, MessageType type, uint64_t token)
+{
+  uint64_t network_token = htobe64(token);
+  return frame_encode(buffer, capacity, type, &network_token, sizeof(network_token));
+}
+
+size_t frame_encode_heartbeat(unsigned char *buffer, size_t capacity, const MacAddress &mac, uint32_t sequence, string_view hostname, uint8_t flags)
+{
+  unsigned char payload[WIRE_MAX_PAYLOAD];
+  size_t hostname_length = std::min<size_t>(hostname.size(), WIRE_MAX_HOSTNAME);
+  uint32_t network_sequence = htonl(sequence);
+  memcpy(payload, mac.mac_addr, MAC_ADDR_MAX);
+  memcpy(payload + MAC_ADDR_MAX, &network_sequence, sizeof(network_sequence));
+  payload[MAC_ADDR_MAX + sizeof(network_sequence)] = (unsigned char)hostname_length;
+  memcpy(payload + MAC_ADDR_MAX + sizeof(network_sequence) + 1, hostname.data(), hostname_length);
+  return frame_encode(buffer, capacity, MESSAGE_HEARTBEAT, payload, MAC_ADDR_MAX + sizeof(network_sequence) + 1 + hostname_length, flags);
+}
+
+bool frame_parse_hello(const Frame &frame, HelloMessage &hello)
+{
+  if (frame.type != MESSAGE_HELLO || frame.length < MAC_ADDR_MAX + 1)
+  {
+    return false;
+  }
+  size_t hostname_length = frame.payload[MAC_ADDR_MAX];
+  if (frame.length != MAC_ADDR_MAX + 1 + hostname_length || hostname_length == 0)
+  {
+    return false;
+  }
+  hello.mac = MacAddress::from_bytes(frame.payload);
+  hello.hostname = string_view((const char *)frame.payload + MAC_ADDR_MAX + 1, hostname_length);
+  return true;
+}
+
+bool frame_parse_probe(const Frame &frame, uint64_t &token)
+{
+  if ((frame.type != MESSAGE_PROBE && frame.type != MESSAGE_PROBE_REPLY) || frame.length != sizeof(uint64_t))
+  {
+    return false;
+  }
+  uint64_t network_token;
+  memcpy(&network_token, frame.payload, sizeof(network_token));
+  token = be64toh(network_token);
+  return true;
+}
+
+bool frame_parse_heartbeat(const Frame &frame, HeartbeatMessage &heartbeat)
+{
+  const size_t fixed = MAC_ADDR_MAX + sizeof(uint32_t) + 1;
+  if (frame.type != MESSAGE_HEARTBEAT || frame.length < fixed)
+  {
+    return false;
+  }
+  size_t hostname_length = frame.payload[fixed - 1];
+  if (frame.length != fixed + hostname_length || hostname_length == 0)
+  {
+    return false;
+  }
+  uint32_t network_sequence;
+  memcpy(&network_sequence, frame.payload + MAC_ADDR_MAX, sizeof(network_sequence));
+  heartbeat.mac = MacAddress::from_bytes(frame.payload);
+  heartbeat.sequence = ntohl(network_sequence);
+  heartbeat.hostname = string_view((const char *)frame.payload + fixed, hostname_length);
+  return true;
+}
+
+// Sequence numbers wrap around, so only their distance counts
+// A restarted sender picks a new starting point, which lands outside the window unless it is very unlucky
+HeartbeatOrder heartbeat_order(uint32_t last, uint32_t sequence, uint32_t &lost)
+{
+  int32_t delta = (int32_t)(sequence - last);
+  lost = 0;
+  if (delta > 0 && delta <= HEARTBEAT_SEQUENCE_WINDOW)
+  {
+    lost = delta - 1;
+    return HEARTBEAT_NEXT;
+  }
+  if (delta <= 0 && delta > -HEARTBEAT_SEQUENCE_WINDOW)
+  {
+    return HEARTBEAT_STALE;
+  }
+  return HEARTBEAT_RESTART;
+}
+
+// Checks a frame header, on success fills everything but the payload
+static FrameResult frame_header(const unsigned char header[WIRE_HEADER_SIZE], Frame &frame)
+{
+  if (header[0] != WIRE_MAGIC || header[1] != WIRE_VERSION)
+  {
+    return FRAME_ERROR;
+  }
+  uint16_t network_length;
+  memcpy(&network_length, header + 4, sizeof(network_length));
+  uint16_t length = ntohs(network_length);
+  if (length > WIRE_MAX_PAYLOAD)
+  {
+    return FRAME_ERROR;
+  }
+  frame.type = (MessageType)header[2];
+  frame.flags = header[3];
+  frame.length = length;
+  return FRAME_READY;
+}
+
+// Decodes a datagram holding exactly one frame, the payload points into the datagram
+FrameResult frame_decode(const unsigned char *datagram, size_t size, Frame &frame)
+{
+  if (size < WIRE_HEADER_SIZE || frame_header(datagram, frame) != FRAME_READY || size != (size_t)WIRE_HEADER_SIZE + frame.length)
+  {
+    return FRAME_ERROR;
+  }
+  frame.payload = datagram + WIRE_HEADER_SIZE;
+  return FRAME_READY;
+}
+
+// Appends whatever the socket has to the decoder buffer, returns what readv returned
+int FrameDecoder::read_from(int file_descriptor)
+{
+  return input.read_from(file_descriptor);
+}
+
+// Takes bytes an I/O engine already received, as many as fit, the rest has to wait for next() to make room
+size_t FrameDecoder::feed(const unsigned char *data, size_t length)
+{
+  size_t taken = std::min(length, input.space());
+  input.push(data, taken);
+  return taken;
+}
+
+FrameResult FrameDecoder::next(Frame &frame)
+{
+  unsigned char header[WIRE_HEADER_SIZE];
+  if (!input.peek(header, WIRE_HEADER_SIZE))
+  {
+    return FRAME_INCOMPLETE;
+  }
+  if (frame_header(header, frame) != FRAME_READY)
+  {
+    return FRAME_ERROR;
+  }
+  if (input.size() < (size_t)WIRE_HEADER_SIZE + frame.length)
+  {
+    return FRAME_INCOMPLETE;
+  }
+  frame.payload = input.contiguous(frame.length, WIRE_HEADER_SIZE, scratch);
+  input.consume(WIRE_HEADER_SIZE + frame.length);
+  return FRAME_READY;
+}
+
+void FrameDecoder::reset()
+{
+  input.clear();
+}
+
+#endif // WIRE_PROTOCOL_IMPLEMENTATION
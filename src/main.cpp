@@ -12,6 +12,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <poll.h>
+#include <limits.h>
 #include <string>
 #include <algorithm>
 #include <thread>
@@ -26,10 +28,36 @@
 #include "../headers/FileDescriptor.hpp"
 #undef FILE_DESCRIPTOR_IMPLEMENTATION
 
+#define EPOLL_IMPLEMENTATION
+#include "../headers/Epoll.hpp"
+#undef EPOLL_IMPLEMENTATION
+
+#define EVENT_FD_IMPLEMENTATION
+#include "../headers/EventFd.hpp"
+#undef EVENT_FD_IMPLEMENTATION
+
+#define ASYNC_IMPLEMENTATION
+#include "../headers/Async.hpp"
+#undef ASYNC_IMPLEMENTATION
+
+#define IO_ENGINE_IMPLEMENTATION
+#define IO_URING_IMPLEMENTATION
+#include "../headers/IoEngine.hpp"
+#undef IO_URING_IMPLEMENTATION
+#undef IO_ENGINE_IMPLEMENTATION
+
 #define SOCKET_IMPLEMENTATION
 #include "../headers/Net/Socket.hpp"
 #undef SOCKET_IMPLEMENTATION
 
+#define METRICS_IMPLEMENTATION
+#include "../headers/metrics.h"
+#undef METRICS_IMPLEMENTATION
+
+#define WIRE_PROTOCOL_IMPLEMENTATION
+#include "../headers/wire_protocol.h"
+#undef WIRE_PROTOCOL_IMPLEMENTATION
+
 #define DISCOVERY_SERVICE_IMPLEMENTATION
 #include "../headers/discovery_service.h"
 #undef DISCOVERY_SERVICE_IMPLEMENTATION
@@ -38,28 +66,32 @@
 #include "../headers/monitoring_service.h"
 #undef MONITORING_SERVICE_IMPLEMENTATION
 
+#define JOURNAL_IMPLEMENTATION
+#include "../headers/journal.h"
+#undef JOURNAL_IMPLEMENTATION
+
 #define MANAGEMENT_IMPLEMENTATION
 #include "../headers/management.hpp"
 #undef MANAGEMENT_IMPLEMENTATION
 
+#define WAKE_ON_LAN_IMPLEMENTATION
+#include "../headers/wake_on_lan.h"
+#undef WAKE_ON_LAN_IMPLEMENTATION
+
 #define COMMANDS_IMPLEMENTATION
 #include "../headers/commands.hpp"
 #undef COMMANDS_IMPLEMENTATION
 
-StringEqComparerIgnoreCase string_equals;
+#define TABLE_RENDERER_IMPLEMENTATION
+#include "../headers/table_renderer.h"
+#undef TABLE_RENDERER_IMPLEMENTATION
 
-// Polls stdin for a key press
-bool key_hit()
-{
-  struct timeval tv = {0, 0};
-  fd_set readfds;
-  FD_ZERO(&readfds);
-  FD_SET(STDIN_FILENO, &readfds);
-  return select(STDIN_FILENO + 1, &readfds, NULL, NULL, &tv) == 1;
-}
+StringEqComparerIgnoreCase string_equals;
 
 DiscoveryService discovery_service;
 MonitoringService monitoring_service;
+MetricsService metrics_service;
+TableRenderer table_renderer;
 bool is_server = false;
 
 // SIGINT handler for properly exiting the program
@@ -69,56 +101,92 @@ void cleanup(int signum)
   int errno_save = errno;
   if (is_server)
   {
-    monitoring_service.tcp_socket.close();
+    // The worker listeners and sessions close with the process
     exit(EXIT_FAILURE);
   }
   else
   {
-    monitoring_service.tcp_socket.send("exit");
+    monitoring_service.send_exit();
     signal(signum, SIG_DFL);
     raise(SIGINT);
   }
   errno = errno_save;
 }
 
-#define CLEAR_SCREEN "\033[2J" // ascii escape code to clear the screen
 // Server side of the program
 int server()
 {
   ParticipantTable participants;
+  // Known participants are back before discovery starts, so they can be woken right away
+  Journal journal;
+  if (journal.open(JOURNAL_DIRECTORY) < 0)
+  {
+    perrorcode("journal");
+  }
+  else
+  {
+    participants.restore(journal);
+    participants.publish_snapshot();
+  }
   discovery_service.start_server();
   monitoring_service.start_server(participants);
+  metrics_service.start_server();
 
-  help_msg_server();
-  participants.print();
+  table_renderer.header = "Manager\n" + help_text_server();
+  table_renderer.draw(*participants.snapshot());
 
+  pollfd wakeups[] = {
+      {.fd = STDIN_FILENO, .events = POLLIN, .revents = 0},
+      {.fd = discovery_service.ready.file_descriptor, .events = POLLIN, .revents = 0},
+      {.fd = participants.changed.file_descriptor, .events = POLLIN, .revents = 0}};
   while (1)
   {
-    participants.lock();   
-    if (key_hit())
+    // Sleeps until a command, a discovery, a status event, the next liveness deadline or a frame held back by the rate cap
+    int64_t wake_at = participants.timers.next_expiry_ms();
+    if (participants.dirty)
     {
-      command_exec(participants);
+      wake_at = std::min(wake_at, table_renderer.next_frame_at_ms());
     }
-    
-    if (participants.dirty)
+    int timeout = wake_at == INT64_MAX ? -1 : (int)std::clamp<int64_t>(wake_at - monotonic_ms(), 0, INT_MAX);
+    if (poll(wakeups, sizeof(wakeups) / sizeof(wakeups[0]), timeout) < 0)
     {
-      std::cout << CLEAR_SCREEN << "Manager\n";
-      help_msg_server();
-      participants.print();
+      if (errno != EINTR)
+      {
+        perror("poll");
+      }
+      continue;
     }
+    Metrics::add(Metrics::MANAGER_WAKEUPS);
 
-    MachineEndpoint discoveredMachine;
-    if (discovery_service.endpoints.dequeue(discoveredMachine))
+    // Commands read the published snapshot and never take the table lock
+    if (wakeups[0].revents & (POLLIN | POLLHUP))
     {
-      participants.add(participant_t{
-          .machine = discoveredMachine,
-          .status = true,
-          .socket = std::make_shared<Socket>(),
-          .last_conection_timestamp = time(NULL)});
+      command_exec(participants);
+      // Whatever the command printed stays until the table changes
+      table_renderer.invalidate();
+      if (feof(stdin))
+      {
+        wakeups[0].fd = -1;
+      }
     }
 
+    // This thread owns the table, everything else reaches it through published events
+    participants.apply_events();
+
+    discovery_service.ready.consume();
+    participants.lock();
+    participants.admit(discovery_service.endpoints);
+    Metrics::set(Metrics::DISCOVERY_QUEUE_DEPTH, discovery_service.endpoints.size_approx());
+    participants.expire(monotonic_ms());
     participants.unlock();
-    msleep(300); // Let other threads get the GODDAMN MUTEX
+
+    participants.persist();
+    participants.publish_snapshot();
+    // A frame held back by the rate cap is drawn on a later wakeup, with every change made in between
+    if (participants.dirty && table_renderer.draw(*participants.snapshot()))
+    {
+      participants.dirty = false;
+    }
   }
   return 0;
 }
@@ -127,27 +195,53 @@ int server()
 int client()
 {
   NetworkInterfaceList network_interfaces = NetworkInterfaceList::begin();
-  std::cout << "MAC ADDRESS: " << MacAddress::get_mac().mac_str << "\nHOSTNAME: " << get_hostname() << "\n"
+  std::cout << "MAC ADDRESS: " << MacAddress::get_mac().str().c_str() << "\nHOSTNAME: " << get_hostname() << "\n"
             << network_interfaces->to_string() << std::endl;
   help_msg_client();
   discovery_service.start_client();
 
+  pollfd wakeups[] = {
+      {.fd = STDIN_FILENO, .events = POLLIN, .revents = 0},
+      {.fd = discovery_service.ready.file_descriptor, .events = POLLIN, .revents = 0}};
   while (1)
   {
-    if (key_hit())
+    // The timeout only lets the loop notice a lost manager
+    if (poll(wakeups, sizeof(wakeups) / sizeof(wakeups[0]), MONITORING_CLIENT_TICK_MS) < 0)
+    {
+      if (errno != EINTR)
+      {
+        perror("poll");
+      }
+      continue;
+    }
+    if (wakeups[0].revents & (POLLIN | POLLHUP))
     {
       string cmd;
       std::cin >> cmd;
       if (string_equals(cmd, "EXIT"))
       {
-        monitoring_service.tcp_socket.send("exit");
+        monitoring_service.send_exit();
         exit(EXIT_SUCCESS);
       }
+      if (!std::cin)
+      {
+        wakeups[0].fd = -1;
+      }
+    }
+    discovery_service.ready.consume();
+    // The manager moved or went away for good, look for it again
+    if (monitoring_service.lost)
+    {
+      monitoring_service.stop();
+      monitoring_service.lost = false;
+      discovery_service.stop();
+      discovery_service.start_client();
     }
     MachineEndpoint server_machine_endpoint;
-    if (!monitoring_service.running && discovery_service.endpoints.dequeue(server_machine_endpoint))
+    if (!monitoring_service.running && discovery_service.endpoints.try_dequeue(server_machine_endpoint))
     {
-      monitoring_service.start_client(server_machine_endpoint);
+      monitoring_service.stop();
+      monitoring_service.start_client(server_machine_endpoint.endpoint());
     }
   }
   return 0;
@@ -169,6 +263,15 @@ int main(int argc, char **argv)
 
   discovery_service.port = INITIAL_PORT + 50;
   monitoring_service.port = INITIAL_PORT + 51;
+  metrics_service.port = INITIAL_PORT + 52;
+  const char *workers = getenv("SLEEP_SERVER_WORKERS");
+  monitoring_service.workers = workers != NULL ? atoi(workers) : 0;
+  const char *fps = getenv("SLEEP_SERVER_FPS");
+  table_renderer.set_fps(fps != NULL ? atoi(fps) : 0);
+  const char *io_engine = getenv("SLEEP_IO_ENGINE");
+  monitoring_service.io_engine = io_engine != NULL ? io_engine : "";
+  const char *heartbeat = getenv("SLEEP_CLIENT_HEARTBEAT");
+  monitoring_service.heartbeat = heartbeat != NULL && atoi(heartbeat) != 0;
 
   ssize_t exit_code;
   if (is_server)
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "DataStructures/ByteRing.h"
+
+#define RING_CAPACITY 16
+
+int main()
+{
+    ByteRing<RING_CAPACITY> ring;
+    unsigned char out[RING_CAPACITY];
+    iovec spans[2];
+
+    // Moves the cursors so the next byte lands three short of the wrap point
+    assert(ring.push("0123456789abc", 13));
+    ring.consume(13);
+    assert(ring.empty());
+
+    // Pushes are all or nothing
+    assert(ring.push("ABCDEFGH", 8));
+    assert(!ring.push("0123456789", 10));
+    assert(ring.size() == 8);
+    assert(ring.space() == 8);
+
+    // The stored bytes straddle the wrap point, so they come back as two spans
+    assert(ring.used_spans(spans) == 2);
+    assert(spans[0].iov_len == 3 && memcmp(spans[0].iov_base, "ABC", 3) == 0);
+    assert(spans[1].iov_len == 5 && memcmp(spans[1].iov_base, "DEFGH", 5) == 0);
+    assert(ring.free_spans(spans) == 1);
+    assert(spans[0].iov_len == 8 && spans[0].iov_base == ring.buffer + 5);
+
+    // Peeks and contiguous views across the wrap point are stitched together
+    assert(ring.peek(out, 6, 1));
+    assert(memcmp(out, "BCDEFG", 6) == 0);
+    assert(!ring.peek(out, 8, 1));
+    unsigned char scratch[RING_CAPACITY];
+    assert(ring.contiguous(5, 1, scratch) == scratch && memcmp(scratch, "BCDEF", 5) == 0);
+    assert(ring.contiguous(4, 3, scratch) == ring.buffer);
+
+    // Fills the gap left in front of the stored bytes through a socket pair, taking only what fits
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    assert(write(pair[1], "ijklmnopqrst", 12) == 12);
+    assert(ring.read_from(pair[0]) == 8);
+    assert(ring.space() == 0);
+    assert(ring.free_spans(spans) == 0);
+    assert(ring.read_from(pair[0]) == -1 && errno == ENOBUFS);
+
+    // Drains in order across the wrap point
+    assert(ring.write_to(pair[0]) == RING_CAPACITY);
+    assert(ring.empty());
+    unsigned char drained[RING_CAPACITY];
+    assert(read(pair[1], drained, sizeof(drained)) == (ssize_t)sizeof(drained));
+    assert(memcmp(drained, "ABCDEFGHijklmnop", sizeof(drained)) == 0);
+    // What did not fit is still waiting in the socket
+    assert(read(pair[0], drained, sizeof(drained)) == 4);
+    assert(memcmp(drained, "qrst", 4) == 0);
+    close(pair[0]);
+    close(pair[1]);
+
+    // Consuming more than is stored only empties the ring
+    assert(ring.push("xy", 2));
+    ring.consume(5);
+    assert(ring.empty() && ring.head == ring.tail);
+
+    std::cout << "test_byte_ring: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <assert.h>
+#include <stdlib.h>
+#include "DataStructures/FlatIndex.h"
+
+// Keys are stored by id the way the participant table keeps its hostnames, the index only holds their hashes
+struct Keys
+{
+    FlatIndex index;
+    std::vector<uint64_t> hashes;
+
+    uint32_t find(uint64_t hash) const
+    {
+        return index.find(hash, [&](uint32_t id)
+                          { return hashes[id] == hash; });
+    }
+
+    uint32_t insert(uint64_t hash)
+    {
+        uint32_t id = hashes.size();
+        hashes.push_back(hash);
+        index.insert(hash, id);
+        return id;
+    }
+
+    // Moves the last key into the hole, the way ParticipantTable::erase keeps its columns dense
+    void erase(uint32_t id)
+    {
+        index.erase(hashes[id], id);
+        uint32_t last = hashes.size() - 1;
+        if (id != last)
+        {
+            index.relabel(hashes[last], last, id);
+            hashes[id] = hashes[last];
+        }
+        hashes.pop_back();
+    }
+
+    void check() const
+    {
+        assert(index.size() == hashes.size());
+        for (uint32_t id = 0; id < hashes.size(); id++)
+        {
+            assert(find(hashes[id]) == id);
+        }
+    }
+};
+
+// The count-th hash whose home is slot in a table of FLAT_INDEX_MIN_CAPACITY slots, mirrors the mixing in FlatIndex
+static uint64_t hash_for_slot(size_t slot, int count)
+{
+    for (uint64_t hash = 1;; hash++)
+    {
+        if ((((hash * 0x9e3779b97f4a7c15ull) >> 32) & (FLAT_INDEX_MIN_CAPACITY - 1)) == slot && count-- == 0)
+        {
+            return hash;
+        }
+    }
+}
+
+int main()
+{
+    const size_t last_slot = FLAT_INDEX_MIN_CAPACITY - 1;
+
+    // One probe chain wrapping from the end of the table to its start: a b c d e sit in the last two slots and the first three
+    Keys wrapped;
+    uint64_t a = hash_for_slot(last_slot - 1, 0);
+    uint64_t b = hash_for_slot(last_slot - 1, 1);
+    uint64_t c = hash_for_slot(last_slot, 0);
+    uint64_t d = hash_for_slot(last_slot - 1, 2);
+    uint64_t e = hash_for_slot(0, 0);
+    for (uint64_t hash : {a, b, c, d, e})
+    {
+        wrapped.insert(hash);
+    }
+    wrapped.check();
+    // Deleting in the middle of the chain shifts everything behind it back across the wrap point
+    wrapped.index.erase(b, 1);
+    assert(wrapped.find(b) == FLAT_INDEX_NIL);
+    for (uint64_t hash : {a, c, d, e})
+    {
+        assert(wrapped.find(hash) != FLAT_INDEX_NIL);
+    }
+    wrapped.index.insert(b, 1);
+    wrapped.check();
+    // So does deleting the entry sitting right before the wrap point
+    wrapped.index.erase(c, 2);
+    for (uint64_t hash : {a, b, d, e})
+    {
+        assert(wrapped.find(hash) != FLAT_INDEX_NIL);
+    }
+    assert(wrapped.find(c) == FLAT_INDEX_NIL);
+    wrapped.index.insert(c, 2);
+    wrapped.check();
+
+    // The last key is shifted back by the erase and then relabelled into the hole
+    Keys moved;
+    moved.insert(hash_for_slot(last_slot, 1));
+    moved.insert(hash_for_slot(last_slot, 2));
+    moved.insert(hash_for_slot(3, 0));
+    moved.insert(hash_for_slot(last_slot, 3));
+    moved.check();
+    moved.erase(0);
+    moved.check();
+    assert(moved.hashes[0] == hash_for_slot(last_slot, 3));
+    moved.erase(1);
+    moved.check();
+    // Erasing the last key relabels nothing
+    moved.erase(1);
+    moved.check();
+    moved.erase(0);
+    assert(moved.index.size() == 0);
+
+    // Random inserts and swap removals against a reference map, through several growths and back down
+    Keys keys;
+    std::unordered_map<uint64_t, bool> reference;
+    srand(25);
+    for (int step = 0; step < 200000; step++)
+    {
+        uint64_t hash = rand() % 3000;
+        bool grow = step < 100000;
+        if (keys.find(hash) == FLAT_INDEX_NIL)
+        {
+            assert(!reference.count(hash));
+            if (grow || rand() % 4 == 0)
+            {
+                keys.insert(hash);
+                reference[hash] = true;
+            }
+        }
+        else
+        {
+            assert(reference.count(hash));
+            if (!grow || rand() % 4 == 0)
+            {
+                keys.erase(keys.find(hash));
+                reference.erase(hash);
+            }
+        }
+        if (step % 10000 == 0)
+        {
+            keys.check();
+        }
+    }
+    keys.check();
+    assert(keys.index.size() == reference.size());
+
+    std::cout << "test_flat_index: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include <iostream>
+#include <vector>
+#include <assert.h>
+#include <stdlib.h>
+
+#define JOURNAL_IMPLEMENTATION
+#include "journal.h"
+#undef JOURNAL_IMPLEMENTATION
+
+static MachineEndpoint machine(const char *hostname, uint32_t address)
+{
+    MachineEndpoint machine(address, 0);
+    machine.mac = MacAddress::from_bytes((const unsigned char *)"\x02\x5c\x00\x00\x00\x01");
+    machine.hostname = hostname;
+    return machine;
+}
+
+static size_t count_records(const string &data, size_t size, std::vector<string> *hostnames = nullptr)
+{
+    size_t count = 0;
+    size_t valid = Journal::decode((const unsigned char *)data.data(), size, [&](JournalRecordKind, const MachineEndpoint &machine, time_t)
+                                   {
+        count++;
+        if (hostnames != nullptr)
+        {
+            hostnames->push_back(machine.hostname.str());
+        } });
+    // Decoding stops on a record boundary, so the count follows from the valid length
+    size_t expected = 0;
+    for (size_t boundary = 0; boundary < valid; expected++)
+    {
+        journal_record_t record;
+        memcpy(&record, data.data() + boundary, sizeof(record));
+        boundary += record.length;
+    }
+    assert(count == expected);
+    return valid;
+}
+
+int main()
+{
+    string data;
+    size_t ends[3];
+    ends[0] = Journal::encode(data, JOURNAL_UPSERT, machine("hopper", 0x0a000001), 100);
+    ends[1] = ends[0] + Journal::encode(data, JOURNAL_UPSERT, machine("sagan", 0x0a000002), 200);
+    ends[2] = ends[1] + Journal::encode(data, JOURNAL_REMOVE, machine("hopper", 0x0a000001), 300);
+    assert(data.size() == ends[2]);
+
+    std::vector<string> hostnames;
+    assert(count_records(data, data.size(), &hostnames) == data.size());
+    assert((hostnames == std::vector<string>{"hopper", "sagan", "hopper"}));
+
+    // Every torn tail is cut off at the last whole record before it
+    for (size_t size = 0; size <= data.size(); size++)
+    {
+        size_t expected = size >= ends[2] ? ends[2] : size >= ends[1] ? ends[1] : size >= ends[0] ? ends[0] : 0;
+        assert(count_records(data, size) == expected);
+    }
+
+    // A garbled byte anywhere in a record stops the replay right before it
+    for (size_t i = ends[0]; i < ends[1]; i++)
+    {
+        string garbled = data;
+        garbled[i] ^= 0x40;
+        assert(count_records(garbled, garbled.size()) == ends[0]);
+    }
+
+    // A torn append is dropped on replay and the journal truncated, so the next append follows the last good record
+    char directory[] = "/tmp/test_journal.XXXXXX";
+    assert(mkdtemp(directory) != NULL);
+    {
+        Journal journal;
+        assert(journal.open(directory) >= 0);
+        journal.append(JOURNAL_UPSERT, machine("hopper", 0x0a000001), 100);
+        journal.append(JOURNAL_UPSERT, machine("sagan", 0x0a000002), 200);
+        assert(journal.flush() == 0);
+        string torn;
+        Journal::encode(torn, JOURNAL_UPSERT, machine("jonas", 0x0a000003), 300);
+        assert(write(journal.file_descriptor, torn.data(), torn.size() - 3) == (ssize_t)torn.size() - 3);
+    }
+    {
+        Journal journal;
+        assert(journal.open(directory) >= 0);
+        hostnames.clear();
+        assert(journal.replay([&](JournalRecordKind, const MachineEndpoint &machine, time_t)
+                              { hostnames.push_back(machine.hostname.str()); }) == 0);
+        assert((hostnames == std::vector<string>{"hopper", "sagan"}));
+        assert(journal.journal_bytes == ends[1]);
+        assert(lseek(journal.file_descriptor, 0, SEEK_END) == (off_t)ends[1]);
+        journal.append(JOURNAL_REMOVE, machine("sagan", 0x0a000002), 400);
+        assert(journal.flush() == 0);
+    }
+    {
+        Journal journal;
+        assert(journal.open(directory) >= 0);
+        hostnames.clear();
+        assert(journal.replay([&](JournalRecordKind, const MachineEndpoint &machine, time_t)
+                              { hostnames.push_back(machine.hostname.str()); }) == 0);
+        assert((hostnames == std::vector<string>{"hopper", "sagan", "sagan"}));
+    }
+    assert(unlink((string(directory) + "/" JOURNAL_FILE).c_str()) == 0);
+    assert(rmdir(directory) == 0);
+
+    std::cout << "test_journal: ok" << std::endl;
+    return 0;
+}
@@ -1,46 +1,119 @@
 #include <iostream>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
+#include <assert.h>
+
+#define NET_IMPLEMENTATION
+#include "Net/Net.hpp"
+#undef NET_IMPLEMENTATION
+
+#define FILE_DESCRIPTOR_IMPLEMENTATION
+#include "FileDescriptor.hpp"
+#undef FILE_DESCRIPTOR_IMPLEMENTATION
+
+#define EVENT_FD_IMPLEMENTATION
+#include "EventFd.hpp"
+#undef EVENT_FD_IMPLEMENTATION
+
+#define SOCKET_IMPLEMENTATION
+#include "Net/Socket.hpp"
+#undef SOCKET_IMPLEMENTATION
+
+#define METRICS_IMPLEMENTATION
+#include "metrics.h"
+#undef METRICS_IMPLEMENTATION
+
+#define JOURNAL_IMPLEMENTATION
+#include "journal.h"
+#undef JOURNAL_IMPLEMENTATION
+
+#define MANAGEMENT_IMPLEMENTATION
 #include "management.hpp"
+#undef MANAGEMENT_IMPLEMENTATION
 
-int main(int argc, char** argv) {
-    // std::mutex mutex;
-    // std::condition_variable cv;
-    // bool updated = false;
-    // int read_count[2] = {0};
-    // int update_count = 0;
+#define WRITER_HOSTS 500
 
-    mutex_data_t mutex_data = {std::mutex(), std::condition_variable(), false, 0, {0}};
-    std::thread writers[2];
-    std::thread readers[2];
-    mutex_data.read_count = std::vector<int>(2, 0);
+static status_event_t event(StatusEventKind kind, int writer, int host)
+{
+    status_event_t event = {};
+    event.kind = kind;
+    event.session = (uint64_t)writer * WRITER_HOSTS + host + 1;
+    event.timestamp = time(NULL);
+    event.machine.hostname = "host-" + std::to_string(writer) + "-" + std::to_string(host);
+    return event;
+}
 
+// Two writers publish status events while two readers walk the snapshots and the owner applies the events
+int main()
+{
     ParticipantTable participants;
-    participant_t p1 = {"hopper", {"1:1:1", "1:1:1:1"}, "8.8.8.8", true};
-    participant_t p2 = {"sagan", {"1:1:1", "1:1:1:1"}, "1.3.8.8", false};
-    participant_t p3 = {"jonas", {"1:1:1", "1:1:1:1"}, "1.3.8.8", true};
-
-    add_participant(participants, p1, mutex_data);
+    std::atomic<bool> done(false);
+    std::thread writers[2];
+    std::thread readers[2];
 
-    writers[0] = std::thread(add_participant, std::ref(participants), p1, std::ref(mutex_data));
-    writers[1] = std::thread(change_participant_state, std::ref(participants), "hopper", std::ref(mutex_data));
-    
-    readers[0] = std::thread(print_management_table, std::ref(participants), std::ref(mutex_data), std::ref(mutex_data.read_count[0]));
-    readers[1] = std::thread(print_management_table, std::ref(participants), std::ref(mutex_data), std::ref(mutex_data.read_count[1]));
+    for (int w = 0; w < 2; w++)
+    {
+        // Every writer joins its own hosts and puts the odd ones to sleep, in order on its own session
+        writers[w] = std::thread([&participants, w]()
+                                 {
+            for (int host = 0; host < WRITER_HOSTS; host++)
+            {
+                participants.publish(event(STATUS_JOINED, w, host));
+            }
+            for (int host = 1; host < WRITER_HOSTS; host += 2)
+            {
+                participants.publish(event(STATUS_ASLEEP, w, host));
+            } });
+    }
+    for (int r = 0; r < 2; r++)
+    {
+        readers[r] = std::thread([&participants, &done]()
+                                 {
+            uint64_t last_version = 0;
+            while (!done.load())
+            {
+                auto snapshot = participants.snapshot();
+                assert(snapshot->version >= last_version);
+                last_version = snapshot->version;
+                for (size_t i = 1; i < snapshot->participants.size(); i++)
+                {
+                    assert(strcasecmp(snapshot->participants[i - 1].machine.hostname.c_str(), snapshot->participants[i].machine.hostname.c_str()) < 0);
+                }
+            } });
+    }
 
-    for (int i = 0; i < 2; i++) {
+    size_t applied = 0;
+    while (applied < 2 * (WRITER_HOSTS + WRITER_HOSTS / 2))
+    {
+        applied += participants.apply_events();
+        participants.publish_snapshot();
+    }
+    done = true;
+    for (int i = 0; i < 2; i++)
+    {
         writers[i].join();
         readers[i].join();
     }
 
-    // add_participant(participants, p1, mutex, updated, cv);
-    // add_participant(participants, p2, mutex, updated, cv);
-    //print_management_table(participants, mutex, updated, cv);
-    
-    //print_participant(get_participant(participants, "hopper"));
-    // remove_participant(participants, "sagan");
-    // print_management_table(participants);
-    
+    assert(participants.size() == 2 * WRITER_HOSTS);
+    assert(participants.count_awake() == WRITER_HOSTS);
+    auto snapshot = participants.snapshot();
+    assert(snapshot->participants.size() == 2 * WRITER_HOSTS);
+    assert(snapshot->find("host-1-2")->status);
+    assert(!snapshot->find("HOST-0-3")->status);
+    assert(snapshot->find("host-2-0") == nullptr);
+
+    // Only the session bound to a participant may remove it
+    status_event_t stale = event(STATUS_LEFT, 0, 4);
+    stale.session++;
+    participants.lock();
+    participants.apply(stale);
+    assert(participants.find("host-0-4") != FLAT_INDEX_NIL);
+    participants.apply(event(STATUS_LEFT, 0, 4));
+    assert(participants.find("host-0-4") == FLAT_INDEX_NIL);
+    participants.unlock();
+    assert(participants.size() == 2 * WRITER_HOSTS - 1);
+
+    std::cout << "test_mgm: ok" << std::endl;
     return 0;
-}
\ No newline at end of file
+}
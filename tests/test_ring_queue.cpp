@@ -0,0 +1,117 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <assert.h>
+#include "DataStructures/RingQueue.h"
+
+#define PRODUCERS 4
+#define CONSUMERS 2
+#define VALUES_PER_PRODUCER 50000
+
+// Runs the cursors around the ring many times with every fill level, single threaded
+template <Concurrent::QueueMode Mode>
+static void check_wraparound()
+{
+    Concurrent::RingQueue<uint64_t, 8, Mode> queue;
+    uint64_t next_in = 0;
+    uint64_t next_out = 0;
+    uint64_t values[8];
+    for (int round = 0; round < 1000; round++)
+    {
+        size_t fill = 1 + round % queue.capacity();
+        for (size_t i = 0; i < fill; i++)
+        {
+            assert(queue.try_enqueue(next_in++));
+        }
+        assert(queue.size_approx() == fill);
+        if (fill == queue.capacity())
+        {
+            assert(!queue.try_enqueue(0));
+        }
+        // Leaves a value behind every other round, so the next round starts mid ring
+        size_t keep = round % 2;
+        assert(queue.drain(values, fill - keep) == fill - keep);
+        for (size_t i = 0; i < fill - keep; i++)
+        {
+            assert(values[i] == next_out++);
+        }
+        if (keep == 1)
+        {
+            queue.dequeue(values[0]);
+            assert(values[0] == next_out++);
+        }
+        assert(!queue.try_dequeue(values[0]));
+        assert(queue.size_approx() == 0);
+    }
+}
+
+// Producers tag every value with their index, consumers check each producer comes out in order and nothing is lost
+template <Concurrent::QueueMode Mode, int Consumers>
+static void check_producers()
+{
+    Concurrent::RingQueue<uint64_t, 64, Mode> queue;
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> consumed(0);
+    std::atomic<uint64_t> checksum(0);
+    for (int producer = 0; producer < PRODUCERS; producer++)
+    {
+        threads.emplace_back([&queue, producer]()
+                             {
+            for (uint64_t i = 0; i < VALUES_PER_PRODUCER; i++)
+            {
+                queue.enqueue(((uint64_t)producer << 32) | i);
+            } });
+    }
+    for (int consumer = 0; consumer < Consumers; consumer++)
+    {
+        threads.emplace_back([&queue, &consumed, &checksum]()
+                             {
+            int64_t last[PRODUCERS];
+            std::fill(std::begin(last), std::end(last), -1);
+            uint64_t sum = 0;
+            while (consumed.load() < (uint64_t)PRODUCERS * VALUES_PER_PRODUCER)
+            {
+                uint64_t value;
+                if (!queue.try_dequeue(value))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                int producer = value >> 32;
+                int64_t sequence = value & UINT32_MAX;
+                assert(producer < PRODUCERS);
+                assert(sequence > last[producer]);
+                last[producer] = sequence;
+                sum += value;
+                consumed++;
+            }
+            checksum += sum; });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    uint64_t expected = 0;
+    for (uint64_t producer = 0; producer < PRODUCERS; producer++)
+    {
+        expected += (producer << 32) * VALUES_PER_PRODUCER + (uint64_t)VALUES_PER_PRODUCER * (VALUES_PER_PRODUCER - 1) / 2;
+    }
+    assert(consumed.load() == (uint64_t)PRODUCERS * VALUES_PER_PRODUCER);
+    assert(checksum.load() == expected);
+    assert(queue.size_approx() == 0);
+}
+
+int main()
+{
+    check_wraparound<Concurrent::SPSC>();
+    check_wraparound<Concurrent::MPSC>();
+    check_wraparound<Concurrent::MPMC>();
+
+    check_producers<Concurrent::MPSC, 1>();
+    check_producers<Concurrent::MPMC, CONSUMERS>();
+
+    std::cout << "test_ring_queue: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <assert.h>
+#include "DataStructures/SeenSet.h"
+
+#define TTL_MS 10
+
+int main()
+{
+    // A key seen again after its time ran out takes its old slot back
+    SeenSet<int> seen(16);
+    seen.insert(1, 10, 0, TTL_MS);
+    assert(*seen.find(1, 5) == 10);
+    assert(seen.find(1, TTL_MS) == nullptr);
+    seen.insert(1, 11, 20, TTL_MS);
+    assert(seen.size() == 1);
+    assert(*seen.find(1, 25) == 11);
+
+    // A new key whose chain runs over an expired entry takes that slot instead of an empty one
+    int reused = 0;
+    for (uint64_t key = 2; key < 1000; key++)
+    {
+        SeenSet<int> copy = seen;
+        copy.insert(key, 12, 40, TTL_MS);
+        if (copy.size() == 1)
+        {
+            assert(copy.find(1, 40) == nullptr);
+            assert(*copy.find(key, 40) == 12);
+            reused++;
+        }
+        else
+        {
+            assert(copy.size() == 2);
+        }
+    }
+    assert(reused > 0);
+
+    // Keys that keep expiring never grow the table, rebuilds just drop them
+    SeenSet<int> churn(16);
+    for (uint64_t key = 0; key < 10000; key++)
+    {
+        churn.insert(key, 0, key * TTL_MS, TTL_MS);
+        assert(churn.find(key, key * TTL_MS) != nullptr);
+    }
+    assert(churn.capacity() == 16);
+    assert(churn.size() <= 12);
+
+    // Live keys past three quarters of the slots make the rebuild grow the table, every one of them stays findable
+    SeenSet<uint64_t> live(16);
+    for (uint64_t key = 0; key < 100; key++)
+    {
+        live.insert(key << 20, key, 0, 1000);
+    }
+    assert(live.size() == 100);
+    assert(live.capacity() >= 128 && live.size() * 4 <= live.capacity() * 3);
+    for (uint64_t key = 0; key < 100; key++)
+    {
+        assert(*live.find(key << 20, 500) == key);
+    }
+    assert(live.find(100 << 20, 500) == nullptr);
+
+    // Once they expire their slots are reused, as many new keys as half the slots fit without growing again
+    size_t capacity = live.capacity();
+    for (uint64_t key = 0; key < capacity / 2; key++)
+    {
+        live.insert(key + 1, key, 2000, 1000);
+    }
+    assert(live.capacity() == capacity);
+    assert(live.find(0, 2000) == nullptr);
+    for (uint64_t key = 0; key < capacity / 2; key++)
+    {
+        assert(*live.find(key + 1, 2500) == key);
+    }
+
+    std::cout << "test_seen_set: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <vector>
+#include <assert.h>
+#include <stdlib.h>
+#include "DataStructures/TimerWheel.h"
+
+#define LEVEL_TICKS(level) (1LL << (TIMER_WHEEL_BITS * (level)))
+
+// Every timer has to fire in the advance call that crosses its deadline, never before and never twice
+static void check_boundaries(int64_t start)
+{
+    TimerWheel<int64_t> wheel(1, start);
+    std::vector<int64_t> deadlines;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (int64_t delta = LEVEL_TICKS(level) - 2; delta <= LEVEL_TICKS(level) + 2; delta++)
+        {
+            deadlines.push_back(start + delta);
+        }
+        // Ends on the next boundary of the absolute clock rather than of the distance from the start
+        deadlines.push_back((start / LEVEL_TICKS(level) + 1) * LEVEL_TICKS(level));
+        deadlines.push_back((start / LEVEL_TICKS(level) + 2) * LEVEL_TICKS(level) - 1);
+    }
+    for (int64_t deadline : deadlines)
+    {
+        wheel.schedule(deadline, deadline);
+    }
+
+    int64_t end = start + LEVEL_TICKS(TIMER_WHEEL_LEVELS - 1) * 3;
+    size_t fired = 0;
+    for (int64_t now = start + 1; now <= end; now++)
+    {
+        fired += wheel.advance(now, [&](uint32_t handle)
+                               {
+            assert(wheel[handle] == now);
+            wheel.cancel(handle); });
+    }
+    assert(fired == deadlines.size());
+    assert(wheel.size() == 0);
+}
+
+int main()
+{
+    check_boundaries(0);
+    check_boundaries(LEVEL_TICKS(2) - 1);
+    check_boundaries(123456789);
+
+    // Cancelled or moved once they cascaded into a finer level, timers stay where they were put
+    TimerWheel<int> wheel(1, 0);
+    uint32_t cancelled = wheel.schedule(1, LEVEL_TICKS(2) + 10);
+    uint32_t earlier = wheel.schedule(2, LEVEL_TICKS(2) + 20);
+    uint32_t later = wheel.schedule(3, LEVEL_TICKS(2) + 30);
+    wheel.schedule(4, LEVEL_TICKS(2) + 40);
+    assert(wheel.advance(LEVEL_TICKS(2) + 1, [](uint32_t)
+                         { assert(false); }) == 0);
+    wheel.cancel(cancelled);
+    wheel.reschedule(earlier, LEVEL_TICKS(2) + 5);
+    wheel.reschedule(later, LEVEL_TICKS(3) + 7);
+    assert(wheel.size() == 3);
+    std::vector<std::pair<int, int64_t>> fired;
+    for (int64_t now = LEVEL_TICKS(2) + 2; now <= LEVEL_TICKS(3) + 100; now++)
+    {
+        wheel.advance(now, [&](uint32_t handle)
+                      { fired.push_back({wheel[handle], now}); });
+    }
+    assert((fired == std::vector<std::pair<int, int64_t>>{{2, LEVEL_TICKS(2) + 5}, {4, LEVEL_TICKS(2) + 40}, {3, LEVEL_TICKS(3) + 7}}));
+    assert(wheel.size() == 0);
+
+    // A callback may cancel a timer sharing its cascaded slot before that one fires
+    TimerWheel<uint32_t> pair(1, 0);
+    uint32_t first = pair.schedule(TIMER_NIL, LEVEL_TICKS(1) + 3);
+    uint32_t second = pair.schedule(first, LEVEL_TICKS(1) + 3);
+    pair[first] = second;
+    size_t count = pair.advance(LEVEL_TICKS(1) + 3, [&](uint32_t handle)
+                                { pair.cancel(pair[handle]); });
+    assert(count == 1);
+    assert(pair.size() == 0);
+
+    // next_expiry_ms never overshoots the earliest deadline, so sleeping until it fires every timer on time
+    assert(TimerWheel<int>(10, 0).next_expiry_ms() == INT64_MAX);
+    srand(7);
+    for (int round = 0; round < 20; round++)
+    {
+        int64_t resolution = 1 + round % 3 * 4;
+        int64_t now = (int64_t)rand() * resolution;
+        TimerWheel<int64_t> sleeper(resolution, now);
+        size_t pending = 0;
+        for (int i = 0; i < 50; i++)
+        {
+            int64_t deadline = now + resolution * (1 + rand() % (int)LEVEL_TICKS(1 + i % 3));
+            deadline -= deadline % resolution;
+            sleeper.schedule(deadline, deadline);
+            pending++;
+        }
+        while (pending > 0)
+        {
+            int64_t next = sleeper.next_expiry_ms();
+            assert(next > now);
+            now = next;
+            pending -= sleeper.advance(now, [&](uint32_t handle)
+                                       {
+                assert(sleeper[handle] == now);
+                sleeper.cancel(handle); });
+        }
+        assert(sleeper.next_expiry_ms() == INT64_MAX);
+    }
+
+    std::cout << "test_timer_wheel: ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <iostream>
+#include <assert.h>
+#include <sys/socket.h>
+
+#define WIRE_PROTOCOL_IMPLEMENTATION
+#include "wire_protocol.h"
+#undef WIRE_PROTOCOL_IMPLEMENTATION
+
+#define PROBE_FRAME_SIZE (WIRE_HEADER_SIZE + sizeof(uint64_t))
+#define HELLO_FRAME_MIN (WIRE_HEADER_SIZE + MAC_ADDR_MAX + 2)
+#define HELLO_FRAME_MAX (HELLO_FRAME_MIN - 1 + WIRE_MAX_HOSTNAME)
+
+// Writes bytes into one end of the pair, returns what the decoder read from the other
+static size_t feed(FrameDecoder &decoder, int pair[2], const unsigned char *bytes, size_t length)
+{
+    assert(write(pair[0], bytes, length) == (ssize_t)length);
+    int result = decoder.read_from(pair[1]);
+    return result < 0 ? 0 : result;
+}
+
+// Decodes padding hellos until the next frame starts at offset in the ring
+static void advance_to(FrameDecoder &decoder, int pair[2], size_t offset)
+{
+    unsigned char buffer[WIRE_MAX_FRAME];
+    Frame frame;
+    size_t gap = offset;
+    while (gap > 0)
+    {
+        size_t size = gap <= HELLO_FRAME_MAX ? gap : std::min<size_t>(HELLO_FRAME_MAX, gap - HELLO_FRAME_MIN);
+        assert(size >= HELLO_FRAME_MIN);
+        size_t length = frame_encode_hello(buffer, sizeof(buffer), MacAddress{}, std::string(size - HELLO_FRAME_MIN + 1, 'p'));
+        assert(length == size);
+        assert(feed(decoder, pair, buffer, length) == length);
+        assert(decoder.next(frame) == FRAME_READY);
+        gap -= size;
+    }
+    assert(decoder.input.empty());
+    assert((decoder.input.tail & (FRAME_DECODER_CAPACITY - 1)) == offset);
+}
+
+// A hello starting at offset, fed in two pieces cut at split, decodes only once the second piece arrives
+static void split_hello(int pair[2], size_t offset, size_t split)
+{
+    FrameDecoder decoder;
+    advance_to(decoder, pair, offset);
+
+    MacAddress mac = MacAddress::from_bytes((const unsigned char *)"\x02\x5c\x01\x02\x03\x04");
+    std::string hostname(40, 'h');
+    hostname[0] = 'a';
+    hostname.back() = 'z';
+    unsigned char buffer[WIRE_MAX_FRAME];
+    size_t length = frame_encode_hello(buffer, sizeof(buffer), mac, hostname);
+    assert(split < length);
+
+    Frame frame;
+    assert(feed(decoder, pair, buffer, split) == split);
+    assert(decoder.next(frame) == FRAME_INCOMPLETE);
+    assert(feed(decoder, pair, buffer + split, length - split) == length - split);
+    assert(decoder.next(frame) == FRAME_READY);
+
+    HelloMessage hello;
+    assert(frame_parse_hello(frame, hello));
+    assert(hello.mac == mac);
+    assert(hello.hostname == hostname);
+    assert(decoder.next(frame) == FRAME_INCOMPLETE);
+}
+
+int main()
+{
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair) == 0);
+
+    // Header cut by the wrap point, then fed across it
+    split_hello(pair, FRAME_DECODER_CAPACITY - 3, 2);
+    split_hello(pair, FRAME_DECODER_CAPACITY - 3, 5);
+    // Payload cut by the wrap point, so it is copied out of the ring
+    split_hello(pair, FRAME_DECODER_CAPACITY - 20, 10);
+    split_hello(pair, FRAME_DECODER_CAPACITY - 20, 30);
+    // Frame ending exactly on the wrap point
+    split_hello(pair, FRAME_DECODER_CAPACITY - (WIRE_HEADER_SIZE + MAC_ADDR_MAX + 1 + 40), 17);
+
+    // Byte at a time, two frames back to back across the wrap point
+    FrameDecoder decoder;
+    advance_to(decoder, pair, FRAME_DECODER_CAPACITY - PROBE_FRAME_SIZE - 4);
+    unsigned char stream[2 * PROBE_FRAME_SIZE];
+    frame_encode_probe(stream, PROBE_FRAME_SIZE, MESSAGE_PROBE_REPLY, 0x0102030405060708ull);
+    frame_encode_probe(stream + PROBE_FRAME_SIZE, PROBE_FRAME_SIZE, MESSAGE_PROBE_REPLY, 0x1112131415161718ull);
+    uint64_t tokens[2];
+    int decoded = 0;
+    for (size_t i = 0; i < sizeof(stream); i++)
+    {
+        assert(feed(decoder, pair, stream + i, 1) == 1);
+        Frame frame;
+        FrameResult result;
+        while ((result = decoder.next(frame)) == FRAME_READY)
+        {
+            assert(frame_parse_probe(frame, tokens[decoded++]));
+        }
+        assert(result == FRAME_INCOMPLETE);
+    }
+    assert(decoded == 2);
+    assert(tokens[0] == 0x0102030405060708ull);
+    assert(tokens[1] == 0x1112131415161718ull);
+
+    // A full decoder only reads what fits, the rest waits in the socket until next() makes room
+    decoder.reset();
+    unsigned char probes[FRAME_DECODER_CAPACITY / PROBE_FRAME_SIZE * PROBE_FRAME_SIZE + PROBE_FRAME_SIZE];
+    for (size_t offset = 0; offset < sizeof(probes); offset += PROBE_FRAME_SIZE)
+    {
+        frame_encode_probe(probes + offset, PROBE_FRAME_SIZE, MESSAGE_PROBE, offset);
+    }
+    assert(feed(decoder, pair, probes, sizeof(probes)) == FRAME_DECODER_CAPACITY);
+    assert(decoder.read_from(pair[1]) == -1 && errno == ENOBUFS);
+    Frame frame;
+    assert(decoder.next(frame) == FRAME_READY);
+    assert(decoder.read_from(pair[1]) == (int)(sizeof(probes) - FRAME_DECODER_CAPACITY));
+    size_t tokens_left = 0;
+    while (decoder.next(frame) == FRAME_READY)
+    {
+        tokens_left++;
+    }
+    assert(tokens_left == sizeof(probes) / PROBE_FRAME_SIZE - 1);
+
+    // Heartbeat sequence numbers, across the wrap point and from a sender that restarted lower down
+    uint32_t lost;
+    assert(heartbeat_order(1000, 1001, lost) == HEARTBEAT_NEXT && lost == 0);
+    assert(heartbeat_order(1000, 1004, lost) == HEARTBEAT_NEXT && lost == 3);
+    assert(heartbeat_order(UINT32_MAX, 1, lost) == HEARTBEAT_NEXT && lost == 1);
+    assert(heartbeat_order(1000, 1000, lost) == HEARTBEAT_STALE);
+    assert(heartbeat_order(1000, 990, lost) == HEARTBEAT_STALE);
+    assert(heartbeat_order(2, UINT32_MAX, lost) == HEARTBEAT_STALE);
+    assert(heartbeat_order(1000, 5, lost) == HEARTBEAT_RESTART && lost == 0);
+    assert(heartbeat_order(0x80001000u, 0x1000, lost) == HEARTBEAT_RESTART);
+    assert(heartbeat_order(1000, 1000 + HEARTBEAT_SEQUENCE_WINDOW + 1, lost) == HEARTBEAT_RESTART && lost == 0);
+
+    // Garbage is an error, not a partial frame
+    decoder.reset();
+    unsigned char garbage[WIRE_HEADER_SIZE] = {0x00, WIRE_VERSION, MESSAGE_PROBE, 0, 0, 8};
+    feed(decoder, pair, garbage, sizeof(garbage));
+    assert(decoder.next(frame) == FRAME_ERROR);
+
+    close(pair[0]);
+    close(pair[1]);
+    std::cout << "test_wire_protocol: ok" << std::endl;
+    return 0;
+}